@@ -0,0 +1,43 @@
+#ifndef JOS_BOOT_BOOTIMG_H
+#define JOS_BOOT_BOOTIMG_H
+
+// Layout of a JOS boot disk, as written by boot/mkimage.c:
+//
+//	sector 0		boot sector (boot.S, main.c)
+//	sector 1		struct Imghdr, the kernel's segment table
+//	sectors 2..		second-stage loader (loader.S, loadermain.c)
+//	4KB-aligned sectors	kernel segments, in increasing address order,
+//				then the initrd (inc/initrd.h), if any
+//
+// bootmain() reads sectors 1 through 1+LOADER_NSECT in one go, so the
+// segment table lands just below the loader at LOADER_ADDR-SECTSIZE
+// and the loader never has to parse the kernel's ELF headers.
+
+#define IMGHDR_MAGIC	0x474D494A	// "JIMG" in little endian
+#define IMGHDR_MAXSEG	16		// keeps struct Imghdr in one sector
+#define IMGSEG_ALIGN	4096		// disk alignment of each segment
+
+// Flag bits for Imgseg::is_flags
+#define IMGSEG_LZ4	0x1		// is_disksz bytes are one LZ4 block
+#define IMGSEG_INITRD	0x2		// the initial RAM disk, not the kernel
+
+// One contiguous run of the kernel's physical memory image.  The
+// loader puts exactly is_filesz bytes at is_pa and zeroes the rest of
+// is_memsz.
+struct Imgseg {
+	uint32_t is_pa;		// physical load address, sector-aligned
+	uint32_t is_sect;	// first disk sector
+	uint32_t is_disksz;	// bytes on disk
+	uint32_t is_filesz;	// bytes after expansion
+	uint32_t is_memsz;	// bytes in memory
+	uint32_t is_flags;
+};
+
+struct Imghdr {
+	uint32_t ih_magic;	// must equal IMGHDR_MAGIC
+	uint32_t ih_entry;	// kernel entry point (physical)
+	uint32_t ih_nseg;
+	struct Imgseg ih_seg[IMGHDR_MAXSEG];
+};
+
+#endif	// !JOS_BOOT_BOOTIMG_H
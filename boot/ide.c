@@ -0,0 +1,180 @@
+// Minimal IDE driver for the second-stage boot loader.
+// Reads sectors from the primary master with bus-master DMA when a
+// PCI IDE controller supports it, and with programmed I/O otherwise.
+
+#include <inc/x86.h>
+
+#include <boot/ide.h>
+
+#define IDE_DATA	0x1F0
+#define IDE_STATUS	0x1F7
+#define IDE_CMD		0x1F7
+
+#define IDE_BSY		0x80
+#define IDE_DRDY	0x40
+#define IDE_DF		0x20
+#define IDE_DRQ		0x08
+#define IDE_ERR		0x01
+
+#define IDE_CMD_READ		0x20
+#define IDE_CMD_READ_DMA	0xC8
+
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+
+// Bus-master IDE registers for the primary channel, relative to BAR4
+#define BM_CMD		0
+#define BM_STATUS	2
+#define BM_PRDT		4
+
+#define BM_CMD_START	0x01
+#define BM_CMD_READ	0x08	// transfer from the device to memory
+#define BM_ST_ERR	0x02
+#define BM_ST_INTR	0x04
+
+#define MAXBATCH	128	// max sectors per read command (64KB)
+
+// Physical Region Descriptor.  A region must not cross a 64KB boundary.
+struct Prd {
+	uint32_t prd_addr;
+	uint32_t prd_count;	// bytes in bits 15:0 (0 means 64KB)
+};
+#define PRD_EOT		0x80000000	// last entry in the table
+
+// A 64KB batch crosses at most one 64KB boundary, so two entries do.
+// The table itself must not cross a 64KB boundary either.
+static struct Prd prdt[2] __attribute__((aligned(16)));
+
+// Bus-master register base, or 0 to use programmed I/O.
+static uint16_t bmbase;
+
+static uint32_t
+pci_conf_read(uint32_t devfn, uint32_t off)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (devfn << 8) | off);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(uint32_t devfn, uint32_t off, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (devfn << 8) | off);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Look on PCI bus 0 for an IDE controller that can bus-master and
+// whose primary channel is at the legacy ports, and enable DMA on it.
+// Returns true if DMA will be used.
+bool
+ide_init(void)
+{
+	uint32_t devfn, class, bar;
+
+	bmbase = 0;
+	for (devfn = 0; devfn < 256; devfn++) {
+		// class code 01 (mass storage), subclass 01 (IDE);
+		// prog-if bit 7: bus master, bit 0: primary in native mode
+		class = pci_conf_read(devfn, 0x08);
+		if ((class >> 16) != 0x0101 || (class & 0x8100) != 0x8000)
+			continue;
+		bar = pci_conf_read(devfn, 0x20);
+		if (!(bar & 1) || !(bar & 0xFFFC))
+			continue;
+		// enable I/O space and bus mastering
+		pci_conf_write(devfn, 0x04, pci_conf_read(devfn, 0x04) | 0x5);
+		bmbase = bar & 0xFFFC;
+		break;
+	}
+	return bmbase != 0;
+}
+
+bool
+ide_dma(void)
+{
+	return bmbase != 0;
+}
+
+static void
+ide_wait(uint8_t mask, uint8_t want)
+{
+	while ((inb(IDE_STATUS) & mask) != want)
+		/* do nothing */;
+}
+
+static void
+ide_command(uint32_t secno, uint32_t nsecs, uint8_t cmd)
+{
+	ide_wait(IDE_BSY|IDE_DRDY, IDE_DRDY);
+
+	outb(0x1F2, nsecs);
+	outb(0x1F3, secno);
+	outb(0x1F4, secno >> 8);
+	outb(0x1F5, secno >> 16);
+	outb(0x1F6, (secno >> 24) | 0xE0);
+	outb(IDE_CMD, cmd);
+}
+
+static void
+ide_pio_read(uint8_t *dst, uint32_t secno, uint32_t nsecs)
+{
+	ide_command(secno, nsecs, IDE_CMD_READ);
+	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
+		ide_wait(IDE_BSY|IDE_DRQ, IDE_DRQ);
+		insl(IDE_DATA, dst, SECTSIZE/4);
+	}
+}
+
+// Let the controller stream 'nsecs' sectors straight to physical
+// address 'dst' (we run with paging off, so that's 'dst' itself).
+static int
+ide_dma_read(uint8_t *dst, uint32_t secno, uint32_t nsecs)
+{
+	uint32_t pa, next, end;
+	struct Prd *prd;
+	uint8_t st;
+
+	end = (uint32_t) dst + nsecs * SECTSIZE;
+	for (pa = (uint32_t) dst, prd = prdt; pa < end; pa = next, prd++) {
+		next = MIN((pa + 0x10000) & ~0xFFFF, end);
+		prd->prd_addr = pa;
+		prd->prd_count = (next - pa) & 0xFFFF;
+	}
+	prd[-1].prd_count |= PRD_EOT;
+
+	outb(bmbase + BM_CMD, 0);
+	outl(bmbase + BM_PRDT, (uint32_t) prdt);
+	// clear the interrupt and error bits by writing ones to them
+	outb(bmbase + BM_STATUS, inb(bmbase + BM_STATUS) | BM_ST_INTR | BM_ST_ERR);
+	outb(bmbase + BM_CMD, BM_CMD_READ);
+
+	ide_command(secno, nsecs, IDE_CMD_READ_DMA);
+	outb(bmbase + BM_CMD, BM_CMD_READ | BM_CMD_START);
+
+	// Interrupts are off; poll for the drive's completion interrupt.
+	while (!((st = inb(bmbase + BM_STATUS)) & (BM_ST_INTR | BM_ST_ERR)))
+		/* do nothing */;
+	outb(bmbase + BM_CMD, 0);
+
+	// reading the drive status also acknowledges its interrupt
+	if ((st & BM_ST_ERR) || (inb(IDE_STATUS) & (IDE_DF|IDE_ERR)))
+		return -1;
+	return 0;
+}
+
+// Read 'nsecs' sectors starting at 'secno' into physical address 'dst',
+// one disk command per batch of up to MAXBATCH sectors.  If a DMA
+// transfer fails, the batch is retried with PIO and DMA stays off.
+void
+ide_read(void *dst, uint32_t secno, uint32_t nsecs)
+{
+	uint8_t *p = dst;
+	uint32_t n;
+
+	for (; nsecs > 0; nsecs -= n, secno += n, p += n * SECTSIZE) {
+		n = MIN(nsecs, MAXBATCH);
+		if (bmbase && ide_dma_read(p, secno, n) < 0)
+			bmbase = 0;
+		if (!bmbase)
+			ide_pio_read(p, secno, n);
+	}
+}
@@ -0,0 +1,12 @@
+#ifndef JOS_BOOT_IDE_H
+#define JOS_BOOT_IDE_H
+
+#include <inc/types.h>
+
+#define SECTSIZE	512
+
+bool ide_init(void);
+bool ide_dma(void);
+void ide_read(void *dst, uint32_t secno, uint32_t nsecs);
+
+#endif	// !JOS_BOOT_IDE_H
@@ -0,0 +1,140 @@
+#include <inc/x86.h>
+#include <inc/bootinfo.h>
+
+#include <boot/bootimg.h>
+#include <boot/ide.h>
+#include <boot/lz4.h>
+
+/**********************************************************************
+ * The second-stage boot loader.
+ *
+ * bootmain() in main.c, which has to fit in the boot sector, reads
+ * the kernel's segment table and this program from sectors 1 through
+ * 1+LOADER_NSECT and jumps here (see boot/bootimg.h for the disk
+ * layout).  We load each kernel segment the table lists -- with
+ * bus-master DMA if the IDE controller supports it, expanding any
+ * segments boot/mkimage.c compressed and zeroing each segment's BSS
+ * -- along with the initial RAM disk, and then jump to the kernel's
+ * entry point.  Along the way we fill in the struct Bootinfo the
+ * kernel reads back (see inc/bootinfo.h).
+ **********************************************************************/
+
+#define IMGHDR		((struct Imghdr *) (LOADER_ADDR - SECTSIZE))
+
+void readseg(struct Imgseg *);
+void readseg_lz4(struct Imgseg *);
+void zeroseg(uint32_t, uint32_t);
+void copyseg(uint32_t, const void *, uint32_t);
+
+void
+loadermain(void)
+{
+	extern char edata[], end[];
+	struct Bootinfo *bi = (struct Bootinfo *) BOOTINFO_PADDR;
+	struct Imgseg *is, *eis;
+	uint32_t flags;
+	char *p;
+
+	// Our BSS wasn't part of what bootmain read off the disk.
+	for (p = edata; p < end; p++)
+		*p = 0;
+
+	bi->bi_tsc[BI_TSC_LOADER] = read_tsc();
+	ide_init();
+
+	// is this a valid image?
+	if (IMGHDR->ih_magic != IMGHDR_MAGIC
+	    || IMGHDR->ih_nseg > IMGHDR_MAXSEG)
+		goto bad;
+	bi->bi_tsc[BI_TSC_KERNHDR] = read_tsc();
+
+	// Load each segment: only its file bytes come off the disk, and
+	// the rest (the BSS) is zeroed here, so the kernel doesn't have
+	// to clear its BSS again.
+	flags = BI_BSS_ZEROED;
+	is = IMGHDR->ih_seg;
+	eis = is + IMGHDR->ih_nseg;
+	for (; is < eis; is++) {
+		if (is->is_flags & IMGSEG_LZ4) {
+			readseg_lz4(is);
+			flags |= BI_LZ4;
+		} else
+			readseg(is);
+		zeroseg(is->is_pa + is->is_filesz, is->is_memsz - is->is_filesz);
+		if (is->is_flags & IMGSEG_INITRD) {
+			bi->bi_initrd = is->is_pa;
+			bi->bi_initrdsz = is->is_filesz;
+			flags |= BI_INITRD;
+		}
+	}
+
+	bi->bi_magic = BOOTINFO_MAGIC;
+	bi->bi_flags = flags | (ide_dma() ? BI_DMA : 0);
+	bi->bi_tsc[BI_TSC_KERNLOADED] = read_tsc();
+
+	// call the entry point from the segment table
+	// note: does not return!
+	((void (*)(void)) (IMGHDR->ih_entry))();
+
+bad:
+	outw(0x8A00, 0x8A00);
+	outw(0x8A00, 0x8E00);
+	while (1)
+		/* do nothing */;
+}
+
+// Read segment 'is' to its load address.  mkimage starts every segment
+// on a sector boundary, so all whole sectors go straight to their
+// final place in as few disk commands as possible; only a partial
+// last sector goes through a bounce buffer, so that we write exactly
+// is_filesz bytes.
+void
+readseg(struct Imgseg *is)
+{
+	static uint8_t bounce[SECTSIZE] __attribute__((aligned(4)));
+	uint32_t nsect = is->is_filesz / SECTSIZE;
+	uint32_t rest = is->is_filesz % SECTSIZE;
+
+	// We run with paging off and an identity segment mapping,
+	// so physical addresses work directly.
+	ide_read((uint8_t *) is->is_pa, is->is_sect, nsect);
+	if (rest) {
+		ide_read(bounce, is->is_sect + nsect, 1);
+		copyseg(is->is_pa + nsect * SECTSIZE, bounce, rest);
+	}
+}
+
+// Load a segment that mkimage compressed.  Its is_disksz compressed
+// bytes are read into the free memory just past the end of the
+// segment and expanded from there straight to is_pa.  Segments are
+// loaded in increasing order, so the scratch copy only ever lands
+// where a later segment will be loaded over it.
+void
+readseg_lz4(struct Imgseg *is)
+{
+	uint8_t *src;
+
+	src = (uint8_t *) ROUNDUP(is->is_pa + is->is_memsz, SECTSIZE);
+	ide_read(src, is->is_sect, ROUNDUP(is->is_disksz, SECTSIZE) / SECTSIZE);
+	lz4_decompress(src, is->is_disksz, (uint8_t *) is->is_pa);
+}
+
+// Copy 'n' bytes from 'src' to physical address 'pa'.
+void
+copyseg(uint32_t pa, const void *src, uint32_t n)
+{
+	asm volatile("cld; rep movsb"
+		     : "+D" (pa), "+S" (src), "+c" (n) : : "cc", "memory");
+}
+
+// Zero 'n' bytes at physical address 'pa', a dword at a time.
+void
+zeroseg(uint32_t pa, uint32_t n)
+{
+	uint32_t nwords = n / 4, nbytes = n % 4;
+
+	asm volatile("cld; rep stosl"
+		     : "+D" (pa), "+c" (nwords) : "a" (0) : "cc", "memory");
+	asm volatile("rep stosb"
+		     : "+D" (pa), "+c" (nbytes) : "a" (0) : "cc", "memory");
+}
@@ -0,0 +1,53 @@
+// LZ4 block decompressor for the second-stage boot loader.
+// boot/mkimage.c produces the compressed kernel segments.
+
+#include <boot/lz4.h>
+
+// LZ4 stores lengths that don't fit in a token nibble as a run of
+// bytes added to 15, ending with the first byte that isn't 255.
+static const uint8_t *
+lz4_len(const uint8_t *src, uint32_t *len)
+{
+	uint8_t b;
+
+	if (*len == 15)
+		do {
+			b = *src++;
+			*len += b;
+		} while (b == 255);
+	return src;
+}
+
+// Expand the LZ4 block of 'srclen' bytes at 'src' into 'dst', which
+// must be large enough to hold the result.  Returns the number of
+// bytes written.  The input is trusted: it came off our own disk.
+uint32_t
+lz4_decompress(const uint8_t *src, uint32_t srclen, uint8_t *dst)
+{
+	const uint8_t *send = src + srclen, *match;
+	uint8_t *d = dst;
+	uint32_t tok, len;
+
+	while (src < send) {
+		tok = *src++;
+
+		// literals
+		len = tok >> 4;
+		src = lz4_len(src, &len);
+		while (len-- > 0)
+			*d++ = *src++;
+
+		// the last sequence is literals only
+		if (src >= send)
+			break;
+
+		// match; it may overlap the bytes it produces
+		match = d - (src[0] | (src[1] << 8));
+		src += 2;
+		len = tok & 15;
+		src = lz4_len(src, &len);
+		for (len += 4; len > 0; len--)
+			*d++ = *match++;
+	}
+	return d - dst;
+}
@@ -0,0 +1,8 @@
+#ifndef JOS_BOOT_LZ4_H
+#define JOS_BOOT_LZ4_H
+
+#include <inc/types.h>
+
+uint32_t lz4_decompress(const uint8_t *src, uint32_t srclen, uint8_t *dst);
+
+#endif	// !JOS_BOOT_LZ4_H
@@ -0,0 +1,338 @@
+// mkimage: build a bootable JOS disk image.
+//
+// Usage: mkimage [-z] [-r initrd] boot loader kernel image
+//
+// Lays out the boot sector, the segment table (struct Imghdr), the
+// second-stage loader, the kernel, and optionally an initial RAM disk
+// (inc/initrd.h) as described in boot/bootimg.h.
+// The kernel's PT_LOAD segments are flattened into runs of contiguous
+// physical memory, each starting on a sector boundary in memory and a
+// 4KB boundary on disk, so the loader can read them with a few large
+// transfers straight to their final address.  With -z, each run that
+// LZ4 makes smaller is stored as one LZ4 block instead.  The initrd
+// becomes one more segment, loaded on the first page past the kernel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <inc/elf.h>
+#include <boot/bootimg.h>
+
+#define SECTSIZE	512
+#define MINSECTS	10000	// pad the image to this many sectors
+
+#define ROUNDUP(a, n)	(((a) + (n) - 1) / (n) * (n))
+
+#define HASHLOG		16
+#define MAXOFFSET	65535
+#define MINMATCH	4
+#define LASTLITERALS	5	// a block always ends with 5 literals
+#define MFLIMIT		12	// and no match starts in its last 12 bytes
+
+static void *
+xmalloc(size_t n)
+{
+	void *p;
+
+	if ((p = malloc(n)) == NULL) {
+		fprintf(stderr, "mkimage: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint8_t *
+put_len(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+// Emit one sequence: 'nlit' literals from 'lit', then a match of
+// 'mlen' bytes at distance 'off' (mlen == 0 for the final sequence).
+static uint8_t *
+put_seq(uint8_t *op, const uint8_t *lit, size_t nlit, size_t off, size_t mlen)
+{
+	uint8_t *tok = op++;
+
+	*tok = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15)
+		op = put_len(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (mlen) {
+		*op++ = off;
+		*op++ = off >> 8;
+		mlen -= MINMATCH;
+		*tok |= mlen < 15 ? mlen : 15;
+		if (mlen >= 15)
+			op = put_len(op, mlen - 15);
+	}
+	return op;
+}
+
+// Greedy LZ4 block compressor with a single-entry hash table.
+// 'out' must have room for lz4_bound(n) bytes.
+static size_t
+lz4_compress(const uint8_t *in, size_t n, uint8_t *out)
+{
+	static int64_t htab[1 << HASHLOG];
+	size_t ip, anchor, mlen;
+	int64_t ref;
+	uint32_t seq, h;
+	uint8_t *op = out;
+
+	for (h = 0; h < (1 << HASHLOG); h++)
+		htab[h] = -1;
+
+	for (ip = anchor = 0; ip + MFLIMIT < n; ) {
+		seq = read32(in + ip);
+		h = (seq * 2654435761U) >> (32 - HASHLOG);
+		ref = htab[h];
+		htab[h] = ip;
+		if (ref < 0 || ip - ref > MAXOFFSET || read32(in + ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		for (mlen = MINMATCH;
+		     ip + mlen < n - LASTLITERALS && in[ref + mlen] == in[ip + mlen];
+		     mlen++)
+			/* do nothing */;
+
+		op = put_seq(op, in + anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	op = put_seq(op, in + anchor, n - anchor, 0, 0);
+	return op - out;
+}
+
+static size_t
+lz4_bound(size_t n)
+{
+	return n + n / 255 + 16;
+}
+
+// Read all of 'name' into a fresh buffer.
+static uint8_t *
+readfile(const char *name, size_t *size)
+{
+	FILE *f;
+	uint8_t *buf;
+	long n;
+
+	if ((f = fopen(name, "rb")) == NULL) {
+		perror(name);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	rewind(f);
+	buf = xmalloc(n + 1);
+	if (fread(buf, 1, n, f) != n) {
+		fprintf(stderr, "mkimage: short read on %s\n", name);
+		exit(1);
+	}
+	fclose(f);
+	*size = n;
+	return buf;
+}
+
+static int
+pacmp(const void *a, const void *b)
+{
+	const struct Proghdr *pa = a, *pb = b;
+
+	return pa->p_pa < pb->p_pa ? -1 : pa->p_pa > pb->p_pa;
+}
+
+static uint8_t *img;		// the disk image being built
+static struct Imghdr *ih;	// its segment table
+static uint32_t nextsect;	// where the next segment goes on disk
+static int lz4;			// compress segments?
+
+// Add a segment whose first 'filesz' of 'memsz' bytes are 'mem'
+// to the image, to be loaded at physical address 'pa'.
+static void
+putseg(uint32_t pa, const uint8_t *mem, uint32_t filesz, uint32_t memsz,
+       uint32_t flags)
+{
+	struct Imgseg *is;
+	uint8_t *blob;
+	size_t zsize;
+
+	if (pa % SECTSIZE) {
+		fprintf(stderr, "mkimage: segment at 0x%x is not "
+			"sector-aligned\n", pa);
+		exit(1);
+	}
+	if (ih->ih_nseg == IMGHDR_MAXSEG) {
+		fprintf(stderr, "mkimage: too many segments\n");
+		exit(1);
+	}
+
+	is = &ih->ih_seg[ih->ih_nseg++];
+	is->is_pa = pa;
+	is->is_sect = nextsect;
+	is->is_filesz = filesz;
+	is->is_memsz = memsz;
+	is->is_disksz = filesz;
+	is->is_flags = flags;
+	if (lz4 && filesz) {
+		blob = xmalloc(lz4_bound(filesz));
+		zsize = lz4_compress(mem, filesz, blob);
+		if (zsize < filesz) {
+			is->is_disksz = zsize;
+			is->is_flags |= IMGSEG_LZ4;
+			mem = blob;
+		}
+	}
+	memcpy(img + nextsect * SECTSIZE, mem, is->is_disksz);
+	nextsect = ROUNDUP(nextsect + ROUNDUP(is->is_disksz, SECTSIZE) / SECTSIZE,
+			   IMGSEG_ALIGN / SECTSIZE);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t *boot, *loader, *kern, *initrd, *mem;
+	size_t bootsize, loadersize, kernsize, initrdsize, imgsize;
+	const char *initrdname = NULL;
+	struct Elf *elf;
+	struct Proghdr *ph, *load, *p;
+	uint32_t start, fileend, memend, kernend;
+	int i, n, nload;
+
+	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+		if (strcmp(argv[1], "-z") == 0)
+			lz4 = 1;
+		else if (strcmp(argv[1], "-r") == 0 && argc > 2) {
+			initrdname = argv[2];
+			argc--, argv++;
+		} else
+			break;
+	}
+	if (argc != 5) {
+		fprintf(stderr, "Usage: mkimage [-z] [-r initrd] "
+			"boot loader kernel image\n");
+		exit(2);
+	}
+
+	boot = readfile(argv[1], &bootsize);
+	loader = readfile(argv[2], &loadersize);
+	kern = readfile(argv[3], &kernsize);
+	initrd = NULL;
+	initrdsize = 0;
+	if (initrdname)
+		initrd = readfile(initrdname, &initrdsize);
+	if (bootsize != SECTSIZE) {
+		fprintf(stderr, "mkimage: %s is not a boot sector\n", argv[1]);
+		exit(1);
+	}
+	if (loadersize > LOADER_NSECT * SECTSIZE) {
+		fprintf(stderr, "mkimage: %s is over %d sectors\n",
+			argv[2], LOADER_NSECT);
+		exit(1);
+	}
+
+	elf = (struct Elf *) kern;
+	if (kernsize < sizeof(*elf) || elf->e_magic != ELF_MAGIC
+	    || elf->e_phoff + elf->e_phnum * sizeof(*ph) > kernsize) {
+		fprintf(stderr, "mkimage: %s is not an ELF image\n", argv[3]);
+		exit(1);
+	}
+	ph = (struct Proghdr *) (kern + elf->e_phoff);
+
+	// Collect the loadable segments in physical address order.
+	load = xmalloc((elf->e_phnum + 1) * sizeof(*load));
+	for (i = nload = 0; i < elf->e_phnum; i++) {
+		if (ph[i].p_type != ELF_PROG_LOAD || ph[i].p_memsz == 0)
+			continue;
+		if (ph[i].p_offset + ph[i].p_filesz > kernsize
+		    || ph[i].p_filesz > ph[i].p_memsz) {
+			fprintf(stderr, "mkimage: segment %d out of range\n", i);
+			exit(1);
+		}
+		load[nload++] = ph[i];
+	}
+	qsort(load, nload, sizeof(*load), pacmp);
+
+	// Worst case every segment grows a little and gets realigned.
+	imgsize = (2 + LOADER_NSECT) * SECTSIZE + IMGSEG_ALIGN;
+	for (i = 0; i < nload; i++)
+		imgsize += lz4_bound(load[i].p_memsz) + IMGSEG_ALIGN;
+	imgsize += lz4_bound(initrdsize) + IMGSEG_ALIGN;
+	imgsize = ROUNDUP(imgsize, SECTSIZE);
+	if (imgsize < MINSECTS * SECTSIZE)
+		imgsize = MINSECTS * SECTSIZE;
+	img = xmalloc(imgsize);
+	memset(img, 0, imgsize);
+	memcpy(img, boot, SECTSIZE);
+	memcpy(img + 2 * SECTSIZE, loader, loadersize);
+
+	ih = (struct Imghdr *) (img + SECTSIZE);
+	ih->ih_magic = IMGHDR_MAGIC;
+	ih->ih_entry = elf->e_entry;
+	nextsect = ROUNDUP(2 + LOADER_NSECT, IMGSEG_ALIGN / SECTSIZE);
+
+	// Merge segments that touch or overlap (.text and .data usually
+	// do) into runs.  A run has to start on a sector boundary, or the
+	// loader would clobber whatever precedes it in that sector.
+	kernend = 0;
+	for (i = 0; i < nload; i = n) {
+		start = load[i].p_pa;
+		memend = start + load[i].p_memsz;
+		for (n = i + 1; n < nload && load[n].p_pa <= memend; n++)
+			if (load[n].p_pa + load[n].p_memsz > memend)
+				memend = load[n].p_pa + load[n].p_memsz;
+
+		// Flatten the run; BSS and holes between segments are zero.
+		mem = xmalloc(memend - start);
+		memset(mem, 0, memend - start);
+		fileend = start;
+		for (p = &load[i]; p < &load[n]; p++) {
+			memcpy(mem + (p->p_pa - start), kern + p->p_offset,
+			       p->p_filesz);
+			if (p->p_pa + p->p_filesz > fileend)
+				fileend = p->p_pa + p->p_filesz;
+		}
+		putseg(start, mem, fileend - start, memend - start, 0);
+		free(mem);
+		kernend = memend;
+	}
+
+	// The initrd goes on the first page past the kernel.
+	if (initrd)
+		putseg(ROUNDUP(kernend, IMGSEG_ALIGN), initrd,
+		       initrdsize, initrdsize, IMGSEG_INITRD);
+
+	if ((f = fopen(argv[4], "wb")) == NULL) {
+		perror(argv[4]);
+		exit(1);
+	}
+	if (fwrite(img, 1, imgsize, f) != imgsize || fclose(f) != 0) {
+		fprintf(stderr, "mkimage: error writing %s\n", argv[4]);
+		unlink(argv[4]);
+		exit(1);
+	}
+	fprintf(stderr, "mkimage: %d segments, %u sectors%s\n",
+		ih->ih_nseg, nextsect, lz4 ? " (LZ4)" : "");
+	return 0;
+}
@@ -0,0 +1,116 @@
+// mkinitrd: pack files into an initial RAM disk (see inc/initrd.h).
+//
+// Usage: mkinitrd [-p prefix] initrd file...
+//
+// Each file is stored under its path with 'prefix' stripped, so
+// "mkinitrd -p obj/ obj/initrd obj/user/hello" stores "user/hello".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <inc/initrd.h>
+
+#define PGSIZE		4096
+
+#define ROUNDUP(a, n)	(((a) + (n) - 1) / (n) * (n))
+
+static void *
+xmalloc(size_t n)
+{
+	void *p;
+
+	if ((p = malloc(n)) == NULL) {
+		fprintf(stderr, "mkinitrd: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f, *out;
+	const char *prefix = "", *name;
+	struct Initrd *ir;
+	struct Initrdent *ie;
+	size_t hdrsize, off;
+	long size;
+	uint8_t *buf;
+	int i, nfiles;
+
+	if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+		prefix = argv[2];
+		argc -= 2, argv += 2;
+	}
+	if (argc < 2) {
+		fprintf(stderr, "Usage: mkinitrd [-p prefix] initrd file...\n");
+		exit(2);
+	}
+	nfiles = argc - 2;
+
+	hdrsize = sizeof(*ir) + nfiles * sizeof(*ie);
+	ir = xmalloc(hdrsize);
+	memset(ir, 0, hdrsize);
+	ir->ir_magic = INITRD_MAGIC;
+	ir->ir_nfiles = nfiles;
+
+	if ((out = fopen(argv[1], "wb")) == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	// Lay out the directory, then each file on its own page.
+	off = ROUNDUP(hdrsize, PGSIZE);
+	for (i = 0; i < nfiles; i++) {
+		ie = &ir->ir_files[i];
+		name = argv[i + 2];
+		if (strncmp(name, prefix, strlen(prefix)) == 0)
+			name += strlen(prefix);
+		if (strlen(name) >= INITRD_NAMELEN) {
+			fprintf(stderr, "mkinitrd: %s: name too long\n", name);
+			goto fail;
+		}
+		strcpy(ie->ie_name, name);
+
+		if ((f = fopen(argv[i + 2], "rb")) == NULL) {
+			perror(argv[i + 2]);
+			goto fail;
+		}
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		rewind(f);
+		buf = xmalloc(size + 1);
+		if (fread(buf, 1, size, f) != size) {
+			fprintf(stderr, "mkinitrd: short read on %s\n", argv[i + 2]);
+			goto fail;
+		}
+		fclose(f);
+
+		ie->ie_off = off;
+		ie->ie_size = size;
+		if (fseek(out, off, SEEK_SET) < 0
+		    || fwrite(buf, 1, size, out) != size) {
+			fprintf(stderr, "mkinitrd: error writing %s\n", argv[1]);
+			goto fail;
+		}
+		free(buf);
+		off = ROUNDUP(off + size, PGSIZE);
+	}
+
+	// Pad the image out to a whole page.
+	ir->ir_size = off;
+	if (fseek(out, 0, SEEK_SET) < 0 || fwrite(ir, 1, hdrsize, out) != hdrsize
+	    || fflush(out) != 0 || ftruncate(fileno(out), off) < 0
+	    || fclose(out) != 0) {
+		fprintf(stderr, "mkinitrd: error writing %s\n", argv[1]);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	unlink(argv[1]);
+	exit(1);
+}
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+# Boot the LZ4-compressed kernel image and the raw one and compare
+# the kernel load times the boot loader reports.
+
+. ./grade-functions.sh
+
+
+$make obj/kern/kernel.img obj/kern/kernel-raw.img
+
+# Print the load cycle count from the boot loader's report in jos.out,
+# if the report says the image was (or, given -r, was not) compressed.
+loadcycles () {
+	if [ "x$1" = "x-r" ]; then
+		pat='^Kernel loaded with [A-Z]* in \([0-9]*\) cycles'
+	else
+		pat='^Kernel loaded with [A-Z]* from an LZ4 image in \([0-9]*\) cycles'
+	fi
+	sed -n "s/$pat.*/\1/p" jos.out
+}
+
+pts=10
+
+qemuopts="-hda obj/kern/kernel-raw.img"
+run
+raw=`loadcycles -r`
+echo_n "Raw image boots: "
+if [ -n "$raw" ] && grep "6828 decimal is" jos.out >/dev/null; then
+	pass "$raw cycles"
+else
+	fail
+fi
+
+qemuopts="-hda obj/kern/kernel.img"
+run
+lz4=`loadcycles`
+echo_n "LZ4 image boots: "
+if [ -n "$lz4" ] && grep "6828 decimal is" jos.out >/dev/null; then
+	pass "$lz4 cycles"
+else
+	fail
+fi
+
+# The decompressed kernel must find its own symbol tables intact.
+echo_n "LZ4 image symbols: "
+if grep "test_backtrace(.*) at kern/init.c:[0-9]*" jos.out >/dev/null; then
+	pass
+else
+	fail
+fi
+
+echo_n "LZ4 image initrd: "
+if grep "^initrd: [0-9]* files" jos.out >/dev/null; then
+	pass
+else
+	fail
+fi
+
+echo_n "LZ4 image loads faster: "
+if [ -n "$raw" ] && [ -n "$lz4" ] && [ "$lz4" -lt "$raw" ]; then
+	pass
+else
+	fail "(raw $raw, lz4 $lz4)"
+fi
+
+showfinal
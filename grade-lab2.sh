@@ -0,0 +1,136 @@
+#!/bin/sh
+
+qemuopts="-hda obj/kern/kernel.img"
+. ./grade-functions.sh
+
+
+$make
+run
+
+pts=20
+echo_n "Page directory: "
+if grep "check_boot_pgdir() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=30
+echo_n "Buddy allocator: "
+if grep "check_page_alloc() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Page magazines: "
+if grep "check_page_mag() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=20
+echo_n "Slab allocator: "
+if grep "check_kmem() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "kmalloc: "
+if grep "check_kmalloc() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Zero pool: "
+if grep "check_zero_pool() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Copy-on-write: "
+if grep "check_cow() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Demand-zero regions: "
+if grep "check_demand_zero() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "User memory checks: "
+if grep "check_user_mem() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "copyin/copyout: "
+if grep "check_copyuser() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Priority scheduler: "
+if grep "check_sched() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Lazy FPU switching: "
+if grep "check_fpu() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "System calls: "
+if grep "check_syscall() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+pts=10
+echo_n "Batched system calls: "
+if grep "check_batch() succeeded!" jos.out >/dev/null
+then
+	pass
+else
+	fail
+fi
+
+showfinal
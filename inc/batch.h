@@ -0,0 +1,51 @@
+#ifndef JOS_INC_BATCH_H
+#define JOS_INC_BATCH_H
+
+// A ring of system calls that an environment queues up and the kernel
+// runs, all in one sys_batch_enter(), at UBATCH in every environment.
+//
+// The environment fills in submission entries at br_sq[br_sq_tail]
+// and advances br_sq_tail; sys_batch_enter() runs them from
+// br_sq_head on and posts each one's result, with its tag, at
+// br_cq[br_cq_tail].  The environment consumes results from
+// br_cq_head.  Indices run freely and are taken mod BATCH_NENTRY.
+// Each side only ever writes its own two indices.
+
+#define BATCH_NENTRY	64		// entries in each queue; a power of 2
+
+// Offsets, for the assembly user stub
+#define BR_SQ_HEAD	0
+#define BR_SQ_TAIL	4
+#define BR_CQ_HEAD	8
+#define BR_CQ_TAIL	12
+#define BR_SQ		16
+#define BR_CQ		(BR_SQ + BATCH_NENTRY * 32)
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct BatchSqe {
+	uint32_t bs_num;		// system call number
+	uint32_t bs_args[5];
+	uint32_t bs_tag;		// comes back with the result
+	uint32_t bs_reserved;
+};
+
+struct BatchCqe {
+	uint32_t bc_tag;
+	int32_t bc_result;
+};
+
+struct BatchRing {
+	volatile uint32_t br_sq_head;	// kernel writes
+	volatile uint32_t br_sq_tail;	// environment writes
+	volatile uint32_t br_cq_head;	// environment writes
+	volatile uint32_t br_cq_tail;	// kernel writes
+	struct BatchSqe br_sq[BATCH_NENTRY];
+	struct BatchCqe br_cq[BATCH_NENTRY];
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BATCH_H */
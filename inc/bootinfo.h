@@ -0,0 +1,76 @@
+#ifndef JOS_INC_BOOTINFO_H
+#define JOS_INC_BOOTINFO_H
+
+/*
+ * The boot loader leaves a struct Bootinfo at physical address
+ * BOOTINFO_PADDR describing how the kernel was loaded.  The kernel
+ * finds it at KERNBASE + BOOTINFO_PADDR.
+ */
+
+#define BOOTINFO_PADDR	0x1000
+#define BOOTINFO_MAGIC	0x4A4F5342
+
+// bi_flags
+#define BI_DMA		0x0001		// kernel loaded with bus-master DMA
+#define BI_LZ4		0x0002		// kernel segments were LZ4-compressed
+#define BI_BSS_ZEROED	0x0004		// the loader zeroed each segment's BSS
+#define BI_INITRD	0x0008		// bi_initrd and bi_initrdsz are valid
+
+// Boot timeline: indexes into bi_tsc[] of the read_tsc() stamps taken
+// at fixed points on the way up.  mon_boottime() prints the phases.
+#define BI_TSC_START		0	// boot.S entered
+#define BI_TSC_A20		1	// A20 enabled
+#define BI_TSC_E820		2	// BIOS memory map collected
+#define BI_TSC_PROTMODE		3	// switched to 32-bit protected mode
+#define BI_TSC_LOADER		4	// second-stage loader entered
+#define BI_TSC_KERNHDR		5	// disk probed, kernel ELF header read
+#define BI_TSC_KERNLOADED	6	// kernel segments loaded
+#define BI_TSC_ENTRY		7	// kernel entry.S entered
+#define BI_TSC_PAGING		8	// paging enabled
+#define BI_TSC_INIT		9	// i386_init entered
+#define BI_TSC_CONS		10	// console initialized
+#define BI_NTSC			11
+
+// The BIOS memory map (INT 15h, AX = E820h), as boot.S collected it
+#define E820_MAX	32		// entries boot.S will store
+#define E820_ENTSIZE	20		// sizeof(struct E820entry)
+#define E820_RAM	1		// E820entry type of usable RAM
+
+// Offsets of the fields boot.S and entry.S fill in
+#define BOOTINFO_TSC	8		// offsetof(struct Bootinfo, bi_tsc)
+#define BOOTINFO_E820NR	(BOOTINFO_TSC + BI_NTSC * 8)
+#define BOOTINFO_E820	(BOOTINFO_E820NR + 4)
+
+#ifdef __ASSEMBLER__
+
+// Record the TSC as boot timeline stamp 'i'.  Works in real mode
+// (with %ds = 0) and in protected mode before or without paging,
+// and clobbers %eax and %edx.
+#define BOOT_TIMESTAMP(i)						\
+	rdtsc;								\
+	movl	%eax, BOOTINFO_PADDR + BOOTINFO_TSC + (i) * 8;		\
+	movl	%edx, BOOTINFO_PADDR + BOOTINFO_TSC + (i) * 8 + 4
+
+#else
+
+#include <inc/types.h>
+
+struct E820entry {
+	uint64_t e_addr;
+	uint64_t e_len;
+	uint32_t e_type;
+} __attribute__((packed));
+
+struct Bootinfo {
+	uint32_t bi_magic;		// BOOTINFO_MAGIC if the rest is valid
+	uint32_t bi_flags;
+	uint64_t bi_tsc[BI_NTSC];	// boot timeline, 0 if not reached
+	uint32_t bi_e820nr;		// number of valid bi_e820[] entries
+	struct E820entry bi_e820[E820_MAX];
+	physaddr_t bi_initrd;		// initial RAM disk (inc/initrd.h)
+	uint32_t bi_initrdsz;
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOTINFO_H */
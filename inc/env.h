@@ -0,0 +1,95 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_INC_ENV_H
+#define JOS_INC_ENV_H
+
+#include <inc/types.h>
+#include <inc/queue.h>
+#include <inc/trap.h>
+#include <inc/memlayout.h>
+
+typedef int32_t envid_t;
+
+// An environment ID 'envid_t' has three parts:
+//
+// +1+---------------21-----------------+--------10--------+
+// |0|          Uniqueifier             |   Environment    |
+// | |                                  |      Index       |
+// +------------------------------------+------------------+
+//                                       \--- ENVX(eid) --/
+//
+// The environment index ENVX(eid) equals the environment's offset in the
+// 'envs[]' array.  The uniqueifier distinguishes environments that were
+// created at different times, but share the same environment index.
+//
+// All real environments are greater than 0 (so the sign bit is zero).
+// envid_ts less than 0 signify errors.  The envid_t == 0 is special, and
+// stands for the current environment.
+
+#define LOG2NENV		10
+#define NENV			(1 << LOG2NENV)
+#define ENVX(envid)		((envid) & (NENV - 1))
+
+// Values of env_status in struct Env
+#define ENV_FREE		0
+#define ENV_RUNNABLE		1
+#define ENV_NOT_RUNNABLE	2
+#define ENV_RUNNING		3
+
+// Scheduling priorities: 0 is the highest
+#define NPRIO			32
+#define ENV_PRIO_DEFAULT	(NPRIO / 2)
+
+// A region of the address space whose pages are made on first touch
+#define NREGION			8	// regions per environment
+
+struct Region {
+	uintptr_t rg_start;		// page-aligned
+	uintptr_t rg_end;		// page-aligned, exclusive; 0 if unused
+	int rg_perm;			// PTE permissions for its pages
+};
+
+// x87, MMX and SSE registers, as FXSAVE stores them
+struct Fxsave {
+	uint16_t fx_fcw;		// x87 control word
+	uint16_t fx_fsw;		// x87 status word
+	uint8_t fx_ftw;			// abridged x87 tag word
+	uint8_t fx_reserved;
+	uint16_t fx_fop;		// last x87 opcode
+	uint32_t fx_fip, fx_fcs;	// last x87 instruction
+	uint32_t fx_fdp, fx_fds;	// last x87 operand
+	uint32_t fx_mxcsr;		// SSE control and status
+	uint32_t fx_mxcsr_mask;
+	uint8_t fx_regs[512 - 32];	// ST0-7, XMM0-7, reserved
+} __attribute__((aligned(16)));
+
+LIST_HEAD(Env_list, Env);		// Declares 'struct Env_list'
+
+struct Env {
+	struct Trapframe env_tf;	// Saved registers
+	LIST_ENTRY(Env) env_link;	// Free list link pointers
+	envid_t env_id;			// Unique environment identifier
+	envid_t env_parent_id;		// env_id of this env's parent
+	unsigned env_status;		// Status of the environment
+	uint32_t env_runs;		// Number of times environment has run
+	int env_prio;			// Scheduling priority
+	TAILQ_ENTRY(Env) env_runlink;	// Run queue link, while runnable
+	int env_cpu;			// CPU whose run queue it's on, or ran on
+
+	// Address space
+	pde_t *env_pgdir;		// Kernel virtual address of page dir
+	physaddr_t env_cr3;		// Physical address of page dir
+	struct Region env_regions[NREGION];	// Demand-zero regions
+
+	// Resident set: the pages this env has mapped below UTOP
+	uint32_t env_rss;
+	uint32_t env_rss_peak;
+	uint32_t env_nzfod;		// Demand-zero faults taken
+
+	// FPU state, loaded on the first FPU instruction after a switch
+	struct Fxsave env_fpu;
+	uint32_t env_fpu_nload;		// #NM traps that loaded env_fpu
+	uint32_t env_fpu_nkeep;		// switches in with env_fpu still loaded
+};
+
+#endif // !JOS_INC_ENV_H
@@ -0,0 +1,29 @@
+#ifndef JOS_INC_INITRD_H
+#define JOS_INC_INITRD_H
+
+// Initial RAM disk format, written by boot/mkinitrd.c.  The boot
+// loader puts the image on a page boundary right after the kernel
+// (see boot/bootimg.h) and the kernel serves files out of it in place.
+//
+// The image starts with a struct Initrd and its directory; the
+// contents of each file start on a page boundary within the image, so
+// that they can be mapped without being copied.
+
+#define INITRD_MAGIC	0x44524E49	// "INRD" in little endian
+#define INITRD_NAMELEN	56
+
+struct Initrdent {
+	char ie_name[INITRD_NAMELEN];	// NUL-terminated
+	uint32_t ie_off;		// from the start of the image
+	uint32_t ie_size;		// in bytes
+};
+
+struct Initrd {
+	uint32_t ir_magic;		// must equal INITRD_MAGIC
+	uint32_t ir_nfiles;
+	uint32_t ir_size;		// size of the whole image
+	uint32_t ir_pad;
+	struct Initrdent ir_files[0];
+};
+
+#endif	// !JOS_INC_INITRD_H
@@ -71,6 +71,11 @@
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
 
+// The kernel marks copy-on-write mappings with one of them: such a
+// page is mapped read-only, and a write fault gives the address space
+// its own copy (see pgdir_cow_fault() in kern/pmap.c).
+#define PTE_COW		0x800	// Copy-on-write
+
 // Only flags in PTE_ALLOWED may be used in system calls.
 #define PTE_ALLOWED	(PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -90,7 +95,10 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+#define CR4_OSXMMEXCPT	0x00000400	// OS handles SIMD exceptions
+#define CR4_OSFXSR	0x00000200	// OS saves SSE state with FXSAVE
 #define CR4_PCE		0x00000100	// Performance counter enable
+#define CR4_PGE		0x00000080	// Page Global Enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
 #define CR4_DE		0x00000008	// Debugging Extensions
@@ -0,0 +1,15 @@
+#ifndef JOS_INC_SYSCALL_H
+#define JOS_INC_SYSCALL_H
+
+/* system call numbers (also used by the assembly stub, hence not an enum) */
+#define SYS_cputs	0
+#define SYS_cgetc	1
+#define SYS_getenvid	2
+#define SYS_env_destroy	3
+#define SYS_page_alloc	4
+#define SYS_page_map	5
+#define SYS_page_unmap	6
+#define SYS_batch_enter	7
+#define NSYSCALLS	8
+
+#endif /* !JOS_INC_SYSCALL_H */
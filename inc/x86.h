@@ -3,6 +3,20 @@
 
 #include <inc/types.h>
 
+// Feature flags returned in %edx by cpuid(1, ...)
+#define CPUID_PSE	0x00000008	// Page Size Extensions
+#define CPUID_TSC	0x00000010	// Time Stamp Counter
+#define CPUID_MSR	0x00000020	// RDMSR and WRMSR
+#define CPUID_APIC	0x00000200	// on-chip local APIC
+#define CPUID_SEP	0x00000800	// SYSENTER and SYSEXIT
+#define CPUID_PGE	0x00002000	// Page Global Enable
+#define CPUID_FXSR	0x01000000	// FXSAVE and FXRSTOR
+
+// Model-specific registers
+#define MSR_IA32_SYSENTER_CS	0x174	// sysenter loads CS from here, SS = CS+8
+#define MSR_IA32_SYSENTER_ESP	0x175	// ...and ESP
+#define MSR_IA32_SYSENTER_EIP	0x176	// ...and EIP
+
 static __inline void breakpoint(void) __attribute__((always_inline));
 static __inline uint8_t inb(int port) __attribute__((always_inline));
 static __inline void insb(int port, void *addr, int cnt) __attribute__((always_inline));
@@ -28,12 +42,18 @@ static __inline uint32_t rcr3(void) __attribute__((always_inline));
 static __inline void lcr4(uint32_t val) __attribute__((always_inline));
 static __inline uint32_t rcr4(void) __attribute__((always_inline));
 static __inline void tlbflush(void) __attribute__((always_inline));
+static __inline void clts(void) __attribute__((always_inline));
+static __inline void fxsave(void *area) __attribute__((always_inline));
+static __inline void fxrstor(const void *area) __attribute__((always_inline));
 static __inline uint32_t read_eflags(void) __attribute__((always_inline));
 static __inline void write_eflags(uint32_t eflags) __attribute__((always_inline));
 static __inline uint32_t read_ebp(void) __attribute__((always_inline));
 static __inline uint32_t read_esp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
+static __inline uint64_t rdmsr(uint32_t msr) __attribute__((always_inline));
+static __inline void wrmsr(uint32_t msr, uint64_t val) __attribute__((always_inline));
+static __inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval) __attribute__((always_inline));
 
 static __inline void
 breakpoint(void)
@@ -219,6 +239,25 @@ tlbflush(void)
 	__asm __volatile("movl %0,%%cr3" : : "r" (cr3));
 }
 
+static __inline void
+clts(void)
+{
+	__asm __volatile("clts");
+}
+
+// area must be 512 bytes, 16-byte aligned
+static __inline void
+fxsave(void *area)
+{
+	__asm __volatile("fxsave %0" : "=m" (*(uint8_t (*)[512]) area) : : "memory");
+}
+
+static __inline void
+fxrstor(const void *area)
+{
+	__asm __volatile("fxrstor %0" : : "m" (*(const uint8_t (*)[512]) area) : "memory");
+}
+
 static __inline uint32_t
 read_eflags(void)
 {
@@ -274,4 +313,31 @@ read_tsc(void)
         return tsc;
 }
 
+static __inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint64_t val;
+	__asm __volatile("rdmsr" : "=A" (val) : "c" (msr));
+	return val;
+}
+
+static __inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	__asm __volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+static __inline uint32_t
+xchg(volatile uint32_t *addr, uint32_t newval)
+{
+	uint32_t result;
+
+	// The + in "+m" denotes a read-modify-write operand.
+	asm volatile("lock; xchgl %0, %1" :
+			 "+m" (*addr), "=a" (result) :
+			 "1" (newval) :
+			 "cc");
+	return result;
+}
+
 #endif /* !JOS_INC_X86_H */
@@ -0,0 +1,63 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_CPU_H
+#define JOS_KERN_CPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
+#include <inc/env.h>
+
+// Maximum number of CPUs
+#define NCPU  8
+
+// Values of status in struct CpuInfo
+enum {
+	CPU_UNUSED = 0,
+	CPU_STARTED,
+	CPU_HALTED,
+};
+
+// Per-CPU state
+struct CpuInfo {
+	uint8_t cpu_id;                 // Index into cpus[] below
+	uint8_t cpu_apicid;             // Local APIC ID
+	volatile unsigned cpu_status;   // The status of the CPU
+	struct Env *cpu_env;            // The currently-running environment.
+	struct Env *cpu_fpu_owner;      // Whose state is in the FPU registers
+	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	uint64_t cpu_startap_tsc;       // When the BSP sent the startup IPIs
+	uint64_t cpu_started_tsc;       // When the CPU reported in
+	void (*volatile cpu_work)(void *); // Set by cpu_run(), run by mp_main()
+	void *cpu_work_arg;
+};
+
+// Initialized in mpconfig.c
+extern struct CpuInfo cpus[NCPU];
+extern int ncpu;                    // Total number of CPUs in the system
+extern struct CpuInfo *bootcpu;     // The boot-strap processor (BSP)
+extern physaddr_t lapicaddr;        // Physical MMIO address of the local APIC
+
+// Per-CPU kernel stacks
+extern unsigned char percpu_kstacks[NCPU][KSTKSIZE];
+
+// Top of CPU i's kernel stack, below KSTACKTOP
+#define KSTACKTOP_CPU(i)	(KSTACKTOP - (i) * (KSTKSIZE + KSTKGAP))
+
+int cpunum(void);
+#define thiscpu (&cpus[cpunum()])
+
+void mp_init(void);
+void lapic_init(void);
+void lapic_startap(uint8_t apicid, uint32_t addr);
+void lapic_eoi(void);
+void microdelay(int us);
+
+void cpu_run(int id, void (*fn)(void *), void *arg);
+int cpu_run_n(int n, void (*fn)(void *), void *arg, int id[],
+	      uint64_t cycles[]);
+
+#endif
@@ -0,0 +1,144 @@
+/* See COPYRIGHT for copyright information. */
+
+// The physical memory map.  boot.S asks the BIOS for it (INT 15h,
+// AX = E820h) and leaves it in the struct Bootinfo; here it is boiled
+// down to a sorted list of usable page ranges.  Without a map we fall
+// back on the base and extended memory sizes kept in NVRAM.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/memlayout.h>
+
+#include <kern/e820.h>
+#include <kern/kclock.h>
+
+struct Memrange memranges[MAXMEMRANGES];
+int nmemranges;
+
+// The E820 map is 64-bit; ROUNDUP and ROUNDDOWN only handle 32 bits.
+#define PGUP64(a)	(((a) + PGSIZE - 1) & ~(uint64_t) (PGSIZE - 1))
+#define PGDOWN64(a)	((a) & ~(uint64_t) (PGSIZE - 1))
+
+// Highest exclusive end we can represent in a physaddr_t
+#define MAXPA		0xFFFFF000ULL
+
+// Add [start, end) to memranges, unsorted, after trimming it to whole
+// pages below 4GB.
+static void
+memrange_add(uint64_t start, uint64_t end)
+{
+	start = PGUP64(start);
+	end = PGDOWN64(MIN(end, MAXPA));
+	if (start >= end)
+		return;
+	if (nmemranges == MAXMEMRANGES) {
+		warn("e820: too many memory ranges, ignoring %llx-%llx",
+		     start, end);
+		return;
+	}
+	memranges[nmemranges].mr_start = start;
+	memranges[nmemranges].mr_end = end;
+	nmemranges++;
+}
+
+// Take [start, end) out of every usable range, splitting as needed.
+// Firmware maps sometimes report reserved areas inside RAM entries.
+static void
+memrange_remove(uint64_t start, uint64_t end)
+{
+	struct Memrange *mr;
+	int i, n = nmemranges;
+
+	for (i = 0; i < n; i++) {
+		mr = &memranges[i];
+		if (end <= mr->mr_start || start >= mr->mr_end)
+			continue;
+		if (start > mr->mr_start && end < mr->mr_end)
+			memrange_add(end, mr->mr_end);
+		if (start > mr->mr_start)
+			mr->mr_end = PGDOWN64(start);
+		else
+			mr->mr_start = MIN(PGUP64(end), (uint64_t) mr->mr_end);
+	}
+}
+
+// Sort memranges by address, merging ranges that touch and dropping
+// empty ones.  There are only a few dozen entries: insertion sort.
+static void
+memrange_sort(void)
+{
+	struct Memrange t;
+	int i, j, n;
+
+	for (i = 1; i < nmemranges; i++) {
+		t = memranges[i];
+		for (j = i; j > 0 && memranges[j-1].mr_start > t.mr_start; j--)
+			memranges[j] = memranges[j-1];
+		memranges[j] = t;
+	}
+
+	for (i = n = 0; i < nmemranges; i++) {
+		if (memranges[i].mr_start >= memranges[i].mr_end)
+			continue;
+		if (n > 0 && memranges[i].mr_start <= memranges[n-1].mr_end)
+			memranges[n-1].mr_end = MAX(memranges[n-1].mr_end,
+						    memranges[i].mr_end);
+		else
+			memranges[n++] = memranges[i];
+	}
+	nmemranges = n;
+}
+
+static int
+nvram_read(int r)
+{
+	return mc146818_read(r) | (mc146818_read(r + 1) << 8);
+}
+
+void
+e820_init(void)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+	struct E820entry *e;
+	uint32_t i, nr, kb;
+
+	static_assert(offsetof(struct Bootinfo, bi_e820nr) == BOOTINFO_E820NR);
+	static_assert(sizeof(struct E820entry) == E820_ENTSIZE);
+
+	nmemranges = 0;
+	nr = bi->bi_magic == BOOTINFO_MAGIC ? MIN(bi->bi_e820nr, E820_MAX) : 0;
+	for (i = 0; i < nr; i++) {
+		e = &bi->bi_e820[i];
+		if (e->e_type == E820_RAM)
+			memrange_add(e->e_addr, e->e_addr + e->e_len);
+	}
+	for (i = 0; i < nr; i++) {
+		e = &bi->bi_e820[i];
+		if (e->e_type != E820_RAM)
+			memrange_remove(e->e_addr, e->e_addr + e->e_len);
+	}
+
+	if (nmemranges == 0) {
+		// NVRAM holds base memory and memory above 1MB, in KB.
+		memrange_add(0, nvram_read(NVRAM_BASELO) * 1024);
+		memrange_add(EXTPHYSMEM,
+			     EXTPHYSMEM + nvram_read(NVRAM_EXTLO) * 1024);
+	}
+
+	memrange_sort();
+
+	for (i = kb = 0; i < nmemranges; i++)
+		kb += (memranges[i].mr_end - memranges[i].mr_start) / 1024;
+	cprintf("Physical memory: %uK available in %d ranges (%s)\n",
+		kb, nmemranges, nr ? "E820" : "NVRAM");
+}
+
+// Take [start, end) out of the usable memory, for memory that the
+// boot loader filled with something the kernel keeps using.
+void
+memrange_reserve(physaddr_t start, physaddr_t end)
+{
+	memrange_remove(start, end);
+	memrange_sort();
+}
@@ -0,0 +1,27 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_E820_H
+#define JOS_KERN_E820_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/bootinfo.h>
+
+// A page-aligned range [mr_start, mr_end) of usable physical memory
+struct Memrange {
+	physaddr_t mr_start;
+	physaddr_t mr_end;
+};
+
+#define MAXMEMRANGES	(2 * E820_MAX)
+
+// Usable RAM, sorted by address, with no two ranges touching
+extern struct Memrange memranges[];
+extern int nmemranges;
+
+void e820_init(void);
+void memrange_reserve(physaddr_t start, physaddr_t end);
+
+#endif	// !JOS_KERN_E820_H
@@ -0,0 +1,442 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+#include <kern/sched.h>
+#include <kern/fpu.h>
+#include <kern/monitor.h>
+
+struct Env *envs = NULL;		// All environments
+static struct Env_list env_free_list;	// Free list
+
+#define ENVGENSHIFT	12		// >= LOGNENV
+
+// Every environment starts with a demand-zero stack this big below
+// USTACKTOP.  It costs nothing until the environment touches it.
+#define ENV_STACKSIZE	(256 * PGSIZE)
+
+//
+// Converts an envid to an env pointer.
+//
+// RETURNS
+//   0 on success, -E_BAD_ENV on error.
+//   On success, sets *env_store to the environment.
+//   On error, sets *env_store to NULL.
+//
+int
+envid2env(envid_t envid, struct Env **env_store, bool checkperm)
+{
+	struct Env *e;
+
+	// If envid is zero, return the current environment.
+	if (envid == 0) {
+		*env_store = curenv;
+		return 0;
+	}
+
+	// Look up the Env structure via the index part of the envid,
+	// then check the env_id field in that struct Env
+	// to ensure that the envid is not stale
+	// (i.e., does not refer to a _previous_ environment
+	// that used the same slot in the envs[] array).
+	e = &envs[ENVX(envid)];
+	if (e->env_status == ENV_FREE || e->env_id != envid) {
+		*env_store = 0;
+		return -E_BAD_ENV;
+	}
+
+	// Check that the calling environment has legitimate permission
+	// to manipulate the specified environment.
+	// If checkperm is set, the specified environment
+	// must be either the current environment
+	// or an immediate child of the current environment.
+	if (checkperm && e != curenv && e->env_parent_id != curenv->env_id) {
+		*env_store = 0;
+		return -E_BAD_ENV;
+	}
+
+	*env_store = e;
+	return 0;
+}
+
+//
+// Mark all environments in 'envs' as free, set their env_ids to 0,
+// and insert them into the env_free_list.
+// Insert in reverse order, so that the first call to env_alloc()
+// returns envs[0].
+//
+void
+env_init(void)
+{
+	int i;
+
+	LIST_INIT(&env_free_list);
+	for (i = NENV - 1; i >= 0; i--) {
+		envs[i].env_id = 0;
+		envs[i].env_status = ENV_FREE;
+		LIST_INSERT_HEAD(&env_free_list, &envs[i], env_link);
+	}
+}
+
+//
+// Allocates and initializes a new environment.
+// On success, the new environment is stored in *newenv_store.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if all NENVS environments are allocated
+//	-E_NO_MEM on memory exhaustion
+//
+int
+env_alloc(struct Env **newenv_store, envid_t parent_id)
+{
+	int32_t generation;
+	int r;
+	struct Env *e;
+
+	if (!(e = LIST_FIRST(&env_free_list)))
+		return -E_NO_FREE_ENV;
+
+	// Allocate and set up the page directory for this environment.
+	if ((r = pgdir_alloc(&e->env_pgdir)) < 0)
+		return r;
+	e->env_cr3 = PADDR(e->env_pgdir);
+
+	// Generate an env_id for this environment.
+	generation = (e->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
+	if (generation <= 0)	// Don't create a negative env_id.
+		generation = 1 << ENVGENSHIFT;
+	e->env_id = generation | (e - envs);
+
+	// Set the basic status variables.
+	e->env_parent_id = parent_id;
+	e->env_status = ENV_NOT_RUNNABLE;
+	e->env_runs = 0;
+	e->env_prio = ENV_PRIO_DEFAULT;
+	e->env_cpu = cpunum();		// start out next to the parent
+
+	// Clear out all the saved register state,
+	// to prevent the register values
+	// of a prior environment inhabiting this Env structure
+	// from "leaking" into our new environment.
+	memset(&e->env_tf, 0, sizeof(e->env_tf));
+	fpu_env_init(e);
+
+	// Set up appropriate initial values for the segment registers.
+	// GD_UD is the user data segment selector in the GDT, and
+	// GD_UT is the user text segment selector (see inc/memlayout.h).
+	// The low 2 bits of each segment register contains the
+	// Requestor Privilege Level (RPL); 3 means user mode.
+	e->env_tf.tf_ds = GD_UD | 3;
+	e->env_tf.tf_es = GD_UD | 3;
+	e->env_tf.tf_ss = GD_UD | 3;
+	e->env_tf.tf_esp = USTACKTOP;
+	e->env_tf.tf_cs = GD_UT | 3;
+
+	// Nothing is mapped yet; the stack and the system call batch
+	// ring come on demand.
+	memset(e->env_regions, 0, sizeof(e->env_regions));
+	e->env_rss = e->env_rss_peak = e->env_nzfod = 0;
+	if ((r = env_region_add(e, USTACKTOP - ENV_STACKSIZE, ENV_STACKSIZE,
+				PTE_U | PTE_W)) < 0
+	    || (r = env_region_add(e, UBATCH, PGSIZE, PTE_U | PTE_W)) < 0)
+		panic("env_alloc: %e", r);
+
+	// commit the allocation
+	LIST_REMOVE(e, env_link);
+	sched_enqueue(e);
+	*newenv_store = e;
+	return 0;
+}
+
+//
+// Frees env e and all memory it uses.
+//
+void
+env_free(struct Env *e)
+{
+	if (e->env_status == ENV_RUNNABLE)
+		sched_dequeue(e);
+
+	// Unmap everything below UTOP, and free the page directory.
+	// If freeing the current environment, this switches to
+	// boot_pgdir first.
+	pgdir_free(e->env_pgdir);
+	e->env_pgdir = NULL;
+	e->env_cr3 = 0;
+	e->env_rss = 0;
+	fpu_env_free(e);
+	if (e == curenv)
+		curenv = NULL;
+
+	// return the environment to the free list
+	e->env_status = ENV_FREE;
+	LIST_INSERT_HEAD(&env_free_list, e, env_link);
+}
+
+//
+// Frees environment e.  If e is the environment this CPU is running in
+// user mode, this doesn't return: the env_run() that started e does.
+//
+void
+env_destroy(struct Env *e)
+{
+	extern void env_leave(uintptr_t esp0) __attribute__((noreturn));
+	bool self = (e == curenv);
+
+	env_free(e);
+	if (self)
+		env_leave(thiscpu->cpu_ts.ts_esp0);
+}
+
+//
+// Run e in user mode, from e->env_tf, until it is destroyed, and then
+// return.  Its traps and system calls run on this kernel stack, just
+// below env_run()'s frame, and return straight to it; nothing else is
+// scheduled on this CPU in the meantime.
+//
+void
+env_run(struct Env *e)
+{
+	extern void env_enter(struct Trapframe *tf, uintptr_t *esp0);
+	struct Env *saved = curenv;
+	uintptr_t esp0 = thiscpu->cpu_ts.ts_esp0;
+
+	if (e->env_status == ENV_RUNNABLE)
+		sched_dequeue(e);
+	e->env_status = ENV_RUNNING;
+	e->env_runs++;
+	curenv = e;
+	fpu_switch(e);
+	lcr3(e->env_cr3);
+	env_enter(&e->env_tf, &thiscpu->cpu_ts.ts_esp0);
+
+	// env_destroy(e) brings us back here, maybe from a sysenter,
+	// which leaves the user's %ds and %es loaded.
+	asm volatile("movw %%ax,%%es; movw %%ax,%%ds" :: "a" (GD_KD));
+	thiscpu->cpu_ts.ts_esp0 = esp0;
+	curenv = saved;
+	fpu_switch(saved);
+	if (saved)
+		lcr3(saved->env_cr3);
+}
+
+//
+// Make [va, va+len) a demand-zero region of e's address space: the
+// first touch of each page in it maps a fresh zeroed page with
+// permissions perm|PTE_P, in env_zero_fault().  Until then the
+// region takes no memory and no page tables.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL, if the range isn't page-aligned, reaches above UTOP,
+//	or overlaps another region
+//   -E_NO_MEM, if e already has NREGION regions
+//
+int
+env_region_add(struct Env *e, uintptr_t va, size_t len, int perm)
+{
+	struct Region *rg, *slot = NULL;
+	uintptr_t end = va + len;
+
+	if (va % PGSIZE || len % PGSIZE || len == 0 || end < va || end > UTOP
+	    || (perm & ~PTE_ALLOWED) || !(perm & PTE_U))
+		return -E_INVAL;
+
+	for (rg = e->env_regions; rg < e->env_regions + NREGION; rg++) {
+		if (rg->rg_end == 0) {
+			if (!slot)
+				slot = rg;
+		} else if (va < rg->rg_end && rg->rg_start < end)
+			return -E_INVAL;
+	}
+	if (!slot)
+		return -E_NO_MEM;
+
+	slot->rg_start = va;
+	slot->rg_end = end;
+	slot->rg_perm = perm;
+	return 0;
+}
+
+// Return e's demand-zero region containing 'va', or NULL.
+static struct Region *
+region_find(struct Env *e, uintptr_t va)
+{
+	struct Region *rg;
+
+	for (rg = e->env_regions; rg < e->env_regions + NREGION; rg++)
+		if (va >= rg->rg_start && va < rg->rg_end)
+			return rg;
+	return NULL;
+}
+
+//
+// Return the permissions, PTE_P included, that the page at 'va' will
+// get from e's demand-zero regions on first touch, or 0 if it's in
+// none of them.
+//
+int
+env_region_perm(struct Env *e, uintptr_t va)
+{
+	struct Region *rg = region_find(e, va);
+
+	return rg ? rg->rg_perm | PTE_P : 0;
+}
+
+//
+// Return the end of e's demand-zero region containing 'va', if that
+// region's pages get at least permissions 'perm'; otherwise return
+// 'va'.  Lets a caller settle a whole region with one lookup.
+//
+uintptr_t
+env_region_end(struct Env *e, uintptr_t va, int perm)
+{
+	struct Region *rg = region_find(e, va);
+
+	if (!rg || ((rg->rg_perm | PTE_P) & perm) != perm)
+		return va;
+	return rg->rg_end;
+}
+
+//
+// Handle a fault on the not-present page at 'va' in e's address
+// space: if it's in one of e's demand-zero regions, map a zeroed page
+// there.  The zero pool usually has one ready.
+//
+// RETURNS:
+//   0 if the access can be retried
+//   -E_FAULT, if 'va' is in no region, or is already mapped
+//   -E_NO_MEM, if there was no memory for the page
+//
+int
+env_zero_fault(struct Env *e, uintptr_t va)
+{
+	struct Region *rg;
+	struct Page *pp;
+	int r;
+
+	if ((rg = region_find(e, va)) == NULL)
+		return -E_FAULT;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (page_lookup(e->env_pgdir, (void *) va, NULL))
+		return -E_FAULT;
+	if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+		return -E_NO_MEM;
+	if ((r = env_page_insert(e, pp, (void *) va, rg->rg_perm)) < 0) {
+		page_free(pp);
+		return r;
+	}
+
+	e->env_nzfod++;
+	return 0;
+}
+
+//
+// Map pp at va in e's address space, as page_insert() does, and count
+// it in e's resident set if nothing was mapped there before.  Every
+// page the kernel maps into an environment should come through here,
+// so that env_rss stays exact.
+//
+int
+env_page_insert(struct Env *e, struct Page *pp, void *va, int perm)
+{
+	bool mapped = page_lookup(e->env_pgdir, va, NULL) != NULL;
+	int r;
+
+	if ((r = page_insert(e->env_pgdir, pp, va, perm)) < 0)
+		return r;
+	if (!mapped && ++e->env_rss > e->env_rss_peak)
+		e->env_rss_peak = e->env_rss;
+	return 0;
+}
+
+//
+// Unmap whatever is mapped at va in e's address space, as
+// page_remove() does, and take it out of e's resident set.
+//
+void
+env_page_remove(struct Env *e, void *va)
+{
+	if (page_lookup(e->env_pgdir, va, NULL) == NULL)
+		return;
+	page_remove(e->env_pgdir, va);
+	assert(e->env_rss > 0);
+	e->env_rss--;
+}
+
+//
+// List the live environments, with how much of the memory their
+// regions reserve is actually resident.
+//
+void
+env_info(void)
+{
+	struct Env *e;
+	struct Region *rg;
+	uint32_t reserved;
+
+	cprintf("%-10s %-6s %10s %10s %10s %10s %8s %8s %8s\n", "env",
+		"status", "reserved K", "resident K", "peak K", "zero faults",
+		"runs", "fpu load", "fpu kept");
+	for (e = envs; e < envs + NENV; e++) {
+		if (e->env_status == ENV_FREE)
+			continue;
+		reserved = 0;
+		for (rg = e->env_regions; rg < e->env_regions + NREGION; rg++)
+			reserved += rg->rg_end - rg->rg_start;
+		cprintf("%08x   %-6s %10u %10u %10u %10u %8u %8u %8u\n",
+			e->env_id,
+			e->env_status == ENV_RUNNING ? "run" :
+			e->env_status == ENV_RUNNABLE ? "ready" : "wait",
+			reserved / 1024, e->env_rss * PGSIZE / 1024,
+			e->env_rss_peak * PGSIZE / 1024, e->env_nzfod,
+			e->env_runs, e->env_fpu_nload, e->env_fpu_nkeep);
+	}
+}
+
+//
+// Check demand-zero regions: a big heap and the stack take no memory
+// until touched, and then only the pages touched, zeroed.  The
+// touches are real faults through the env's page tables.
+//
+void
+check_demand_zero(void)
+{
+	struct Env *e, *saved = curenv;
+	volatile uint32_t *p;
+
+	assert(env_alloc(&e, 0) == 0);
+	assert(env_region_add(e, UTEXT, 64 << 20, PTE_U | PTE_W) == 0);
+	assert(env_region_add(e, UTEXT + PGSIZE, PGSIZE, PTE_U) == -E_INVAL);
+	assert(env_region_add(e, UTEXT - PGSIZE, 100, PTE_U) == -E_INVAL);
+	assert(e->env_rss == 0);
+	assert(!(e->env_pgdir[PDX(UTEXT)] & PTE_P));
+
+	curenv = e;
+	lcr3(e->env_cr3);
+	p = (uint32_t *) (UTEXT + (32 << 20) + 8);
+	assert(*p == 0);		// read fault maps a zeroed page
+	*p = 0x2e90;			// which is writable
+	*(volatile uint32_t *) (USTACKTOP - 4) = 1;
+	lcr3(boot_cr3);
+	curenv = saved;
+
+	assert(e->env_rss == 2 && e->env_nzfod == 2);
+	assert(page_lookup(e->env_pgdir, (void *) UTEXT, NULL) == NULL);
+	assert(env_zero_fault(e, (uintptr_t) p) == -E_FAULT);
+	assert(env_zero_fault(e, UTEXT - PGSIZE) == -E_FAULT);
+	env_page_remove(e, (void *) (USTACKTOP - PGSIZE));
+	env_page_remove(e, (void *) (USTACKTOP - PGSIZE));
+	assert(e->env_rss == 1);
+
+	env_free(e);
+	cprintf("check_demand_zero() succeeded!\n");
+}
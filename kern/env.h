@@ -0,0 +1,28 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_ENV_H
+#define JOS_KERN_ENV_H
+
+#include <inc/env.h>
+#include <kern/cpu.h>
+
+extern struct Env *envs;		// All environments
+#define curenv (thiscpu->cpu_env)	// Current environment
+
+void	env_init(void);
+int	env_alloc(struct Env **e, envid_t parent_id);
+void	env_free(struct Env *e);
+void	env_destroy(struct Env *e);
+void	env_run(struct Env *e);
+int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+
+int	env_region_add(struct Env *e, uintptr_t va, size_t len, int perm);
+int	env_region_perm(struct Env *e, uintptr_t va);
+uintptr_t env_region_end(struct Env *e, uintptr_t va, int perm);
+int	env_zero_fault(struct Env *e, uintptr_t va);
+int	env_page_insert(struct Env *e, struct Page *pp, void *va, int perm);
+void	env_page_remove(struct Env *e, void *va);
+void	env_info(void);
+void	check_demand_zero(void);
+
+#endif // !JOS_KERN_ENV_H
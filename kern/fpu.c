@@ -0,0 +1,255 @@
+// Lazy FPU context switching.
+//
+// An environment's x87/MMX/SSE registers are 512 bytes of FXSAVE
+// state.  Rather than save and restore them on every context switch,
+// a CPU leaves whatever environment last used the FPU in the
+// registers (its cpu_fpu_owner) and switches with CR0_TS set.  The
+// first FPU instruction afterwards traps with #NM; only then does
+// fpu_trap() save the owner's state and load the current
+// environment's.  Environments that never touch the FPU never cost a
+// save or a restore, and one that gets the CPU back before anything
+// else used the FPU finds its state still loaded and doesn't trap.
+//
+// An environment's state can only be saved by the CPU whose registers
+// hold it, so run queues leave a CPU's owner where it is when other
+// CPUs steal or balance.
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/fpu.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+
+// Without FXSAVE there is no way to switch FPU state; leave the FPU
+// alone, and let environments share it.
+static bool fpu_lazy;
+
+// Save and restore on every switch instead, for comparison.
+bool fpu_eager;
+
+// Turn on FXSAVE and SSE, and make FPU instructions trap until the
+// first switch decides otherwise.
+void
+fpu_init_percpu(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_FXSR)) {
+		if (cpunum() == 0)
+			cprintf("FPU: no FXSAVE; FPU state is not switched\n");
+		return;
+	}
+	fpu_lazy = 1;
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	lcr0((rcr0() | CR0_MP | CR0_NE | CR0_TS) & ~CR0_EM);
+}
+
+// Give e the FPU state of a freshly reset processor.
+void
+fpu_env_init(struct Env *e)
+{
+	memset(&e->env_fpu, 0, sizeof(e->env_fpu));
+	e->env_fpu.fx_fcw = 0x037F;	// all exceptions masked
+	e->env_fpu.fx_mxcsr = 0x1F80;	// likewise
+	e->env_fpu_nload = e->env_fpu_nkeep = 0;
+}
+
+// e is going away; make sure no CPU still thinks it owns the FPU.
+void
+fpu_env_free(struct Env *e)
+{
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		if (cpus[i].cpu_fpu_owner == e)
+			cpus[i].cpu_fpu_owner = NULL;
+}
+
+// This CPU is about to run e (or nothing, if e is NULL).
+void
+fpu_switch(struct Env *e)
+{
+	struct Env *owner = thiscpu->cpu_fpu_owner;
+
+	if (!fpu_lazy)
+		return;
+
+	if (fpu_eager) {
+		clts();
+		if (owner)
+			fxsave(&owner->env_fpu);
+		if (e)
+			fxrstor(&e->env_fpu);
+		thiscpu->cpu_fpu_owner = e;
+		if (!e)
+			lcr0(rcr0() | CR0_TS);
+		return;
+	}
+
+	if (e && e == owner) {
+		clts();
+		e->env_fpu_nkeep++;
+	} else
+		lcr0(rcr0() | CR0_TS);
+}
+
+// This CPU is going to stop running environments: save its FPU owner's
+// state back into the owner, so that another CPU can run it.
+void
+fpu_save_owner(void)
+{
+	struct Env *owner = thiscpu->cpu_fpu_owner;
+
+	if (!fpu_lazy || !owner)
+		return;
+	clts();
+	fxsave(&owner->env_fpu);
+	thiscpu->cpu_fpu_owner = NULL;
+	lcr0(rcr0() | CR0_TS);
+}
+
+// Device-not-available (#NM): curenv used the FPU while CR0_TS was
+// set.  Swap its state in and let the instruction run again.
+void
+fpu_trap(void)
+{
+	struct Env *owner = thiscpu->cpu_fpu_owner;
+
+	assert(curenv && fpu_lazy);
+	clts();
+	if (owner == curenv)
+		return;
+	if (owner)
+		fxsave(&owner->env_fpu);
+	fxrstor(&curenv->env_fpu);
+	curenv->env_fpu_nload++;
+	// Only now may another CPU take the old owner.
+	thiscpu->cpu_fpu_owner = curenv;
+}
+
+
+//
+// Check that two environments each keep their own x87 stack across
+// switches, that an environment only traps when someone else used the
+// FPU in between, and that one that doesn't use the FPU doesn't trap.
+//
+void
+check_fpu(void)
+{
+	struct Env *e[2], *saved = curenv;
+	int i, v;
+
+	if (!fpu_lazy)
+		return;
+
+	// Above anything else runnable, so they take turns.
+	for (i = 0; i < 2; i++) {
+		assert(env_alloc(&e[i], 0) == 0);
+		sched_setprio(e[i], 0);
+	}
+
+	curenv = NULL;
+	sched_yield();
+	assert(curenv == e[0] && (rcr0() & CR0_TS));
+	v = 1111;
+	asm volatile("fildl %0" : : "m" (v));
+	assert(e[0]->env_fpu_nload == 1);
+	assert(thiscpu->cpu_fpu_owner == e[0]);
+
+	sched_yield();
+	assert(curenv == e[1] && (rcr0() & CR0_TS));
+	v = 2222;
+	asm volatile("fildl %0" : : "m" (v));
+	assert(e[1]->env_fpu_nload == 1);
+
+	sched_yield();
+	assert(curenv == e[0]);
+	asm volatile("fistpl %0" : "=m" (v));
+	assert(v == 1111 && e[0]->env_fpu_nload == 2);
+
+	sched_yield();
+	assert(curenv == e[1]);
+	asm volatile("fistpl %0" : "=m" (v));
+	assert(v == 2222 && e[1]->env_fpu_nload == 2);
+
+	// e[0] leaves the FPU alone, so e[1]'s state is still loaded.
+	sched_yield();
+	assert(curenv == e[0] && (rcr0() & CR0_TS));
+	sched_yield();
+	assert(curenv == e[1] && !(rcr0() & CR0_TS));
+	v = 3333;
+	asm volatile("fildl %0; fistpl %0" : "+m" (v));
+	assert(v == 3333 && e[1]->env_fpu_nload == 2);
+	assert(e[1]->env_fpu_nkeep == 1 && e[0]->env_fpu_nkeep == 0);
+
+	curenv = saved;
+	for (i = 0; i < 2; i++)
+		env_free(e[i]);
+	assert(thiscpu->cpu_fpu_owner == NULL);
+	fpu_switch(saved);
+	lcr3(saved ? saved->env_cr3 : boot_cr3);
+	cprintf("check_fpu() succeeded!\n");
+}
+
+//
+// Time context switches between two environments, with FPU state
+// switched eagerly and lazily, when neither uses the FPU and when
+// both use it every time they run.  Each switch is a sched_yield(),
+// address space switch included.
+//
+void
+fpu_bench(int niter)
+{
+	struct Env *e[2], *saved = curenv;
+	uint64_t t0, cycles[2];
+	int i, j, r, usefpu, mode;
+
+	if (!fpu_lazy) {
+		cprintf("fpu_bench: no FXSAVE\n");
+		return;
+	}
+	for (i = 0; i < 2; i++) {
+		if ((r = env_alloc(&e[i], 0)) < 0) {
+			cprintf("fpu_bench: %e\n", r);
+			while (--i >= 0)
+				env_free(e[i]);
+			return;
+		}
+		sched_setprio(e[i], 0);
+	}
+
+	cprintf("%-12s %16s %16s\n", "envs", "eager cycles", "lazy cycles");
+	curenv = NULL;
+	sched_yield();
+	for (usefpu = 0; usefpu < 2; usefpu++) {
+		for (mode = 0; mode < 2; mode++) {
+			fpu_eager = !mode;
+			t0 = read_tsc();
+			for (j = 0; j < niter; j++) {
+				sched_yield();
+				if (usefpu)
+					asm volatile("fldz; fstp %st(0)");
+			}
+			cycles[mode] = read_tsc() - t0;
+		}
+		cprintf("%-12s %16llu %16llu\n",
+			usefpu ? "use FPU" : "integer only",
+			cycles[0] / niter, cycles[1] / niter);
+	}
+	fpu_eager = 0;
+
+	curenv = saved;
+	for (i = 0; i < 2; i++) {
+		cprintf("env %08x: %u runs, %u FPU loads, %u kept\n",
+			e[i]->env_id, e[i]->env_runs, e[i]->env_fpu_nload,
+			e[i]->env_fpu_nkeep);
+		env_free(e[i]);
+	}
+	fpu_switch(saved);
+	lcr3(saved ? saved->env_cr3 : boot_cr3);
+}
@@ -0,0 +1,23 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+extern bool fpu_eager;
+
+void	fpu_init_percpu(void);
+void	fpu_env_init(struct Env *e);
+void	fpu_env_free(struct Env *e);
+void	fpu_switch(struct Env *e);
+void	fpu_save_owner(void);
+void	fpu_trap(void);
+
+void	check_fpu(void);
+void	fpu_bench(int niter);
+
+#endif	// !JOS_KERN_FPU_H
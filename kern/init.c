@@ -3,9 +3,26 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/memlayout.h>
+#include <inc/bootinfo.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/e820.h>
+#include <kern/pmap.h>
+#include <kern/initrd.h>
+#include <kern/kmem.h>
+#include <kern/kclock.h>
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/trap.h>
+#include <kern/sched.h>
+#include <kern/picirq.h>
+#include <kern/fpu.h>
+#include <kern/syscall.h>
+
+static void boot_aps(void);
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -19,22 +36,79 @@ test_backtrace(int x)
 	cprintf("leaving test_backtrace %d\n", x);
 }
 
+// Report how the boot loader brought us in.
+static void
+boot_report(void)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+
+	if (bi->bi_magic != BOOTINFO_MAGIC)
+		return;
+	cprintf("Kernel loaded with %s%s in %llu cycles\n",
+		(bi->bi_flags & BI_DMA) ? "DMA" : "PIO",
+		(bi->bi_flags & BI_LZ4) ? " from an LZ4 image" : "",
+		bi->bi_tsc[BI_TSC_KERNLOADED] - bi->bi_tsc[BI_TSC_LOADER]);
+}
+
 void
 i386_init(void)
 {
 	extern char edata[], end[];
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+
+	bi->bi_tsc[BI_TSC_INIT] = read_tsc();
 
 	// Before doing anything else, complete the ELF loading process.
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
-	memset(edata, 0, end - edata);
+	// Our boot loader already does this while loading us.
+	if (bi->bi_magic != BOOTINFO_MAGIC || !(bi->bi_flags & BI_BSS_ZEROED))
+		memset(edata, 0, end - edata);
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
 
+	bi->bi_tsc[BI_TSC_CONS] = read_tsc();
+
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	boot_report();
+	e820_init();
+	// boot_aps() copies the AP startup code here.
+	memrange_reserve(MPENTRY_PADDR, MPENTRY_PADDR + PGSIZE);
+
+	// Lab 2 memory management initialization functions
+	i386_vm_init();
+
+	initrd_init();
+	page_init();
+	kmem_init();
+
+	// Lab 4 multiprocessor initialization functions
+	mp_init();
+	lapic_init();
+	pic_init();
+	seg_init_percpu();
+
+	// Lab 3 user environment initialization functions
+	env_init();
+	sched_init();
+	idt_init();
+	fpu_init_percpu();
+	// These need the IDT for their page faults.
+	check_cow();
+	check_demand_zero();
+	check_user_mem();
+	check_copyuser();
+	check_sched();
+	check_fpu();
+	check_syscall();
+	check_batch();
+
+	// Starting non-boot CPUs
+	boot_aps();
+
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
 
@@ -43,6 +117,165 @@ i386_init(void)
 		monitor(NULL);
 }
 
+// While boot_aps is booting a given CPU, it communicates the per-core
+// stack pointer that should be loaded by mpentry.S to that CPU in
+// this variable, and the CPU's APIC ID in mpentry_apicid.  The CPU
+// claims the stack by swapping ~0 into mpentry_apicid.
+void *mpentry_kstack;
+volatile uint32_t mpentry_apicid = ~0;
+
+// How long to wait for an AP to report in before giving up on it
+#define AP_TIMEOUT_US	100000
+
+// Start the non-boot (AP) processors.
+static void
+boot_aps(void)
+{
+	extern unsigned char mpentry_start[], mpentry_end[];
+	void *code;
+	struct CpuInfo *c;
+	uint64_t timeout;
+
+	// Write entry code to unused memory at MPENTRY_PADDR
+	code = KADDR(MPENTRY_PADDR);
+	memmove(code, mpentry_start, mpentry_end - mpentry_start);
+
+	// Boot each AP one at a time
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == cpus + cpunum())  // We've started already.
+			continue;
+
+		// Tell mpentry.S what stack to use.  It can't use the
+		// mapping below KSTACKTOP yet, since it's on entry_pgdir.
+		mpentry_kstack = percpu_kstacks[c - cpus] + KSTKSIZE;
+		mpentry_apicid = c->cpu_apicid;
+		// Start the CPU at mpentry_start
+		c->cpu_startap_tsc = read_tsc();
+		lapic_startap(c->cpu_apicid, PADDR(code));
+		// Wait for the CPU to finish some basic setup in mp_main()
+		timeout = c->cpu_startap_tsc
+			+ tsc_freq() / 1000000 * AP_TIMEOUT_US;
+		while (c->cpu_status != CPU_STARTED && read_tsc() < timeout)
+			;
+		if (c->cpu_status == CPU_STARTED)
+			continue;
+		// Take the stack back, unless the CPU just claimed it;
+		// then it's on its way, and mpentry_kstack must hold
+		// until it is.
+		if (xchg(&mpentry_apicid, ~0) == c->cpu_apicid) {
+			c->cpu_status = CPU_HALTED;
+			cprintf("SMP: CPU %d did not start\n", c->cpu_id);
+		} else
+			while (c->cpu_status != CPU_STARTED)
+				;
+	}
+}
+
+// Setup code for APs
+void
+mp_main(void)
+{
+	uint64_t now = read_tsc();
+
+	// We are in high EIP now, safe to switch to boot_pgdir
+	vm_init_percpu();
+	cprintf("SMP: CPU %d starting\n", cpunum());
+
+	lapic_init();
+	seg_init_percpu();
+	idt_init_percpu();
+	fpu_init_percpu();
+	thiscpu->cpu_started_tsc = now;
+	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
+
+	// Run whatever cpu_run() hands us, and zero pages in the
+	// meantime.  This CPU's run queue stays offline and empty unless
+	// that work schedules (see sched_start()), so there's nothing
+	// here to sched_yield() to.
+	for (;;) {
+		if (thiscpu->cpu_work) {
+			thiscpu->cpu_work(thiscpu->cpu_work_arg);
+			thiscpu->cpu_work = NULL;
+		}
+		page_zero_idle();
+		asm volatile("pause");
+	}
+}
+
+// Have CPU 'id', which must be idling in mp_main(), call fn(arg).
+// Returns without waiting for fn to finish; fn has to report back
+// itself.
+void
+cpu_run(int id, void (*fn)(void *), void *arg)
+{
+	struct CpuInfo *c = &cpus[id];
+
+	assert(c != thiscpu && c->cpu_status == CPU_STARTED);
+	while (c->cpu_work)
+		asm volatile("pause");
+	c->cpu_work_arg = arg;
+	asm volatile("" ::: "memory");	// store the argument first
+	c->cpu_work = fn;
+}
+
+// What cpu_run_n() hands each CPU
+static struct {
+	void (*fn)(void *);
+	void *arg;
+	volatile bool go;
+	volatile bool ready[NCPU];
+	volatile bool done[NCPU];
+	uint64_t cycles[NCPU];
+} run_n;
+
+static void
+cpu_run_n_worker(void *unused)
+{
+	int id = cpunum();
+	uint64_t t0;
+
+	run_n.ready[id] = 1;
+	while (!run_n.go)
+		asm volatile("pause");
+	t0 = read_tsc();
+	run_n.fn(run_n.arg);
+	run_n.cycles[id] = read_tsc() - t0;
+	run_n.done[id] = 1;
+}
+
+// Call fn(arg) on n CPUs at once, this one included, or on as many as
+// have started if that's fewer, and wait for every call to return.
+// They all start together.  Fills in id[] with the CPUs used, and
+// cycles[] with how long fn took on each, and returns how many CPUs
+// that was.  For benchmarks: only one cpu_run_n() at a time.
+int
+cpu_run_n(int n, void (*fn)(void *), void *arg, int id[], uint64_t cycles[])
+{
+	int i, j, self = cpunum();
+
+	memset(&run_n, 0, sizeof(run_n));
+	run_n.fn = fn;
+	run_n.arg = arg;
+	id[0] = self;
+	for (i = 1, j = 0; i < n && j < ncpu; j++)
+		if (j != self && cpus[j].cpu_status == CPU_STARTED)
+			id[i++] = j;
+	n = i;		// in case some CPU never started
+	for (i = 1; i < n; i++) {
+		cpu_run(id[i], cpu_run_n_worker, NULL);
+		while (!run_n.ready[id[i]])
+			asm volatile("pause");
+	}
+	run_n.go = 1;
+	cpu_run_n_worker(NULL);
+	for (i = 0; i < n; i++) {
+		while (!run_n.done[id[i]])
+			asm volatile("pause");
+		cycles[i] = run_n.cycles[id[i]];
+	}
+	return n;
+}
+
 
 /*
  * Variable panicstr contains argument to first call to panic; used as flag
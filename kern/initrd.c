@@ -0,0 +1,78 @@
+/* See COPYRIGHT for copyright information. */
+
+// The initial RAM disk.  The boot loader puts it on the first page
+// past the kernel and records where in the struct Bootinfo.  We map
+// it read-only in place and hand out pointers straight into it,
+// so a file's contents are never copied, and since each file starts
+// on a page boundary its pages can later be mapped as they are.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/bootinfo.h>
+
+#include <kern/initrd.h>
+#include <kern/e820.h>
+#include <kern/pmap.h>
+
+const struct Initrd *initrd;
+
+void
+initrd_init(void)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+	const struct Initrd *ir;
+	uintptr_t va;
+	uint32_t i;
+
+	if (bi->bi_magic != BOOTINFO_MAGIC || !(bi->bi_flags & BI_INITRD))
+		return;
+
+	// Whatever happens, the page allocator must leave it alone.
+	memrange_reserve(bi->bi_initrd, bi->bi_initrd + bi->bi_initrdsz);
+
+	ir = KADDR(bi->bi_initrd);
+	if (bi->bi_initrdsz < sizeof(*ir) || ir->ir_magic != INITRD_MAGIC
+	    || ir->ir_size > bi->bi_initrdsz
+	    || ir->ir_nfiles > (ir->ir_size - sizeof(*ir)) / sizeof(ir->ir_files[0])) {
+		warn("initrd at 0x%08x is corrupt", bi->bi_initrd);
+		return;
+	}
+	for (i = 0; i < ir->ir_nfiles; i++)
+		if (ir->ir_files[i].ie_off > ir->ir_size
+		    || ir->ir_files[i].ie_size > ir->ir_size - ir->ir_files[i].ie_off
+		    || strnlen(ir->ir_files[i].ie_name, INITRD_NAMELEN) == INITRD_NAMELEN) {
+			warn("initrd entry %d is corrupt", i);
+			return;
+		}
+
+	// Remap its pages read-only; CR0_WP makes that stick for the
+	// kernel too.  The pages are global, so invlpg each one.
+	boot_map_segment(boot_pgdir, (uintptr_t) ir, ROUNDUP(ir->ir_size, PGSIZE),
+			 bi->bi_initrd, PTE_G);
+	for (va = (uintptr_t) ir; va < (uintptr_t) ir + ir->ir_size; va += PGSIZE)
+		invlpg((void *) va);
+	initrd = ir;
+	cprintf("initrd: %d files, %uK at 0x%08x\n",
+		ir->ir_nfiles, ir->ir_size / 1024, bi->bi_initrd);
+}
+
+// Find the file called 'name' in the initrd.  Returns a read-only
+// pointer to its contents and sets '*size', or returns NULL.
+const void *
+initrd_lookup(const char *name, size_t *size)
+{
+	uint32_t i;
+
+	if (!initrd)
+		return NULL;
+	for (i = 0; i < initrd->ir_nfiles; i++)
+		if (strcmp(initrd->ir_files[i].ie_name, name) == 0) {
+			*size = initrd->ir_files[i].ie_size;
+			return (const uint8_t *) initrd + initrd->ir_files[i].ie_off;
+		}
+	return NULL;
+}
@@ -0,0 +1,18 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_INITRD_H
+#define JOS_KERN_INITRD_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/initrd.h>
+
+// The initial RAM disk, or NULL if the boot loader didn't load one
+extern const struct Initrd *initrd;
+
+void initrd_init(void);
+const void *initrd_lookup(const char *name, size_t *size);
+
+#endif	// !JOS_KERN_INITRD_H
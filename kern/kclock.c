@@ -0,0 +1,60 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+
+#include <kern/kclock.h>
+
+#define CALIBRATE_MS	10
+
+unsigned
+mc146818_read(unsigned reg)
+{
+	outb(IO_RTC, reg);
+	return inb(IO_RTC+1);
+}
+
+void
+mc146818_write(unsigned reg, unsigned datum)
+{
+	outb(IO_RTC, reg);
+	outb(IO_RTC+1, datum);
+}
+
+static uint64_t tsc_hz;
+
+// Count TSC cycles across CALIBRATE_MS milliseconds of PIT counter 2,
+// run as a one-shot with its gate held high and the speaker off.
+static uint64_t
+tsc_calibrate(void)
+{
+	uint32_t latch = TIMER_FREQ / (1000 / CALIBRATE_MS);
+	uint64_t t0, t1;
+
+	outb(IO_PPI, (inb(IO_PPI) & ~0x02) | 0x01);
+	outb(TIMER_MODE, 0xB0);		// counter 2, lsb then msb, mode 0
+	outb(TIMER_CNTR2, latch & 0xFF);
+	outb(TIMER_CNTR2, latch >> 8);
+
+	t0 = read_tsc();
+	// counter 2's output goes high when the count reaches zero
+	while (!(inb(IO_PPI) & 0x20))
+		/* do nothing */;
+	t1 = read_tsc();
+
+	return (t1 - t0) * (1000 / CALIBRATE_MS);
+}
+
+// Return the TSC frequency in Hz, measuring it on first use.
+uint64_t
+tsc_freq(void)
+{
+	if (!tsc_hz)
+		tsc_hz = tsc_calibrate();
+	return tsc_hz;
+}
+
+uint64_t
+tsc_to_us(uint64_t cycles)
+{
+	return cycles * 1000000 / tsc_freq();
+}
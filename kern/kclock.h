@@ -0,0 +1,41 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KCLOCK_H
+#define JOS_KERN_KCLOCK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// The 8253/8254 programmable interval timer
+#define	IO_TIMER1	0x040		// counters 0-2 and mode register
+#define	TIMER_FREQ	1193182		// input clock, in Hz
+#define	TIMER_CNTR2	(IO_TIMER1 + 2)	// counter 2 (PC speaker)
+#define	TIMER_MODE	(IO_TIMER1 + 3)	// mode register
+#define	IO_PPI		0x061		// gate and output of counter 2
+
+#define	IO_RTC		0x070		// RTC port
+
+// Clock ticks per second.  Each CPU's local APIC timer ticks at this
+// rate, timed against the TSC.
+#define HZ		100
+
+#define	MC_NVRAM_START	0xe	// start of NVRAM: offset 14
+#define	MC_NVRAM_SIZE	50	// 50 bytes of NVRAM
+
+// NVRAM bytes 7 & 8: base memory size
+#define NVRAM_BASELO	(MC_NVRAM_START + 7)	// low byte; RTC off. 0x15
+#define NVRAM_BASEHI	(MC_NVRAM_START + 8)	// high byte; RTC off. 0x16
+
+// NVRAM bytes 9 & 10: extended memory size
+#define NVRAM_EXTLO	(MC_NVRAM_START + 9)	// low byte; RTC off. 0x17
+#define NVRAM_EXTHI	(MC_NVRAM_START + 10)	// high byte; RTC off. 0x18
+
+unsigned mc146818_read(unsigned reg);
+void mc146818_write(unsigned reg, unsigned datum);
+
+uint64_t tsc_freq(void);
+uint64_t tsc_to_us(uint64_t cycles);
+
+#endif	// !JOS_KERN_KCLOCK_H
@@ -0,0 +1,647 @@
+/* See COPYRIGHT for copyright information. */
+
+// Object caches ("slab allocator"), after Bonwick, "The Slab
+// Allocator: An Object-Caching Kernel Memory Allocator", USENIX 1994.
+//
+// Each cache hands out objects of one size, carved from slabs of
+// 2^kc_order pages taken from the buddy allocator.  A slab starts with
+// its struct Slab; every page of it points back there through
+// Page::pp_slab, so freeing needs no per-object header.  Slabs after
+// the first start their objects at different cache-line offsets
+// ("colors"), so that the same object in different slabs doesn't
+// always land in the same cache set.
+//
+// In front of the slabs, each CPU has a small stack of free objects,
+// so most allocations and frees take no lock.
+
+#include <inc/types.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+#include <inc/assert.h>
+
+#include <kern/kmem.h>
+#include <kern/pmap.h>
+
+#define KMEM_COLOR	64		// cache line size, the color unit
+#define KMEM_MAXORDER	3		// largest slab: 8 pages
+#define KMEM_MAXEMPTY	1		// empty slabs a cache keeps around
+
+struct KmemCache_list kmem_caches;	// all caches, for kmem_cache_info()
+static struct spinlock kmem_lock;	// protects kmem_caches
+
+// The cache the other caches' struct KmemCache come from
+static struct KmemCache kmem_cache_cache;
+
+static void check_kmem(void);
+static void check_kmalloc(void);
+static void kmalloc_init(void);
+
+// Where the free-list link lives in an object.  Objects with a
+// constructor must keep their constructed state while free, so their
+// link goes after the object instead of in its first word.
+static inline void **
+obj_link(struct KmemCache *kc, void *obj)
+{
+	if (kc->kc_ctor)
+		return (void **) ((char *) obj + kc->kc_size - sizeof(void *));
+	return (void **) obj;
+}
+
+// Fill in kc for objects of 'size' bytes aligned to 'align'.
+// Returns -1 if an object doesn't fit in a slab.
+static int
+kmem_cache_setup(struct KmemCache *kc, const char *name, size_t size,
+		 size_t align, void (*ctor)(void *))
+{
+	size_t slabsz, hdr, waste;
+	int i;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	assert((align & (align - 1)) == 0);
+
+	memset(kc, 0, sizeof(*kc));
+	strncpy(kc->kc_name, name, KMEM_NAMELEN - 1);
+	kc->kc_align = align;
+	kc->kc_ctor = ctor;
+	if (ctor)
+		size += sizeof(void *);
+	kc->kc_size = ROUNDUP(MAX(size, sizeof(void *)), align);
+
+	// Use the smallest slab that wastes at most an eighth of itself
+	hdr = ROUNDUP(sizeof(struct Slab), align);
+	for (kc->kc_order = 0; ; kc->kc_order++) {
+		slabsz = PGSIZE << kc->kc_order;
+		kc->kc_nobj = slabsz > hdr ? (slabsz - hdr) / kc->kc_size : 0;
+		waste = slabsz - hdr - kc->kc_nobj * kc->kc_size;
+		if (kc->kc_nobj > 0 && waste * 8 <= slabsz)
+			break;
+		if (kc->kc_order == KMEM_MAXORDER) {
+			if (kc->kc_nobj == 0)
+				return -1;
+			break;
+		}
+	}
+
+	// The leftover space gives the colors.  Objects aligned to more
+	// than a cache line don't get colored.
+	kc->kc_ncolor = align <= KMEM_COLOR ? waste / KMEM_COLOR + 1 : 1;
+
+	spin_initlock(&kc->kc_lock);
+	LIST_INIT(&kc->kc_full);
+	LIST_INIT(&kc->kc_partial);
+	LIST_INIT(&kc->kc_empty);
+	for (i = 0; i < NCPU; i++)
+		kc->kc_cpu[i].cc_count = 0;
+
+	spin_lock(&kmem_lock);
+	LIST_INSERT_HEAD(&kmem_caches, kc, kc_link);
+	spin_unlock(&kmem_lock);
+	return 0;
+}
+
+void
+kmem_init(void)
+{
+	spin_initlock(&kmem_lock);
+	LIST_INIT(&kmem_caches);
+	if (kmem_cache_setup(&kmem_cache_cache, "kmem_cache",
+			     sizeof(struct KmemCache), KMEM_COLOR, NULL) < 0)
+		panic("kmem_init: can't make the cache of caches");
+
+	check_kmem();
+	kmalloc_init();
+	check_kmalloc();
+}
+
+//
+// Create a cache of objects of 'size' bytes, each aligned to 'align'
+// (a power of two; 0 means pointer alignment).  If ctor isn't NULL,
+// it is called on each object when its slab is made, and the cache
+// expects objects back in that constructed state.
+//
+// Returns NULL if out of memory or the objects are too big for a slab.
+//
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *))
+{
+	struct KmemCache *kc;
+
+	if ((kc = kmem_cache_alloc(&kmem_cache_cache)) == NULL)
+		return NULL;
+	if (kmem_cache_setup(kc, name, size, align, ctor) < 0) {
+		kmem_cache_free(&kmem_cache_cache, kc);
+		return NULL;
+	}
+	return kc;
+}
+
+// Make a new slab for kc.  The caller holds kc_lock.
+static struct Slab *
+slab_create(struct KmemCache *kc)
+{
+	struct Page *pp;
+	struct Slab *sl;
+	char *obj;
+	int i;
+
+	if ((pp = page_alloc_order(kc->kc_order, 0)) == NULL)
+		return NULL;
+	for (i = 0; i < 1 << kc->kc_order; i++)
+		pp[i].pp_slab = page2kva(pp);
+
+	sl = page2kva(pp);
+	sl->sl_cache = kc;
+	sl->sl_inuse = 0;
+	sl->sl_free = NULL;
+
+	obj = (char *) ROUNDUP((uintptr_t) (sl + 1), kc->kc_align)
+		+ kc->kc_color * KMEM_COLOR;
+	kc->kc_color = (kc->kc_color + 1) % kc->kc_ncolor;
+	for (i = kc->kc_nobj - 1; i >= 0; i--) {
+		if (kc->kc_ctor)
+			kc->kc_ctor(obj + i * kc->kc_size);
+		*obj_link(kc, obj + i * kc->kc_size) = sl->sl_free;
+		sl->sl_free = obj + i * kc->kc_size;
+	}
+	kc->kc_nslab++;
+	return sl;
+}
+
+// Give an empty slab's pages back.  The caller holds kc_lock.
+static void
+slab_destroy(struct KmemCache *kc, struct Slab *sl)
+{
+	struct Page *pp = pa2page(PADDR(sl));
+	int i;
+
+	for (i = 0; i < 1 << kc->kc_order; i++)
+		pp[i].pp_slab = NULL;
+	kc->kc_nslab--;
+	page_free_order(pp, kc->kc_order);
+}
+
+// Take one object off kc's slabs.  The caller holds kc_lock.
+static void *
+slab_get(struct KmemCache *kc)
+{
+	struct Slab *sl;
+	void *obj;
+
+	if ((sl = LIST_FIRST(&kc->kc_partial)) == NULL) {
+		if ((sl = LIST_FIRST(&kc->kc_empty)) != NULL) {
+			LIST_REMOVE(sl, sl_link);
+			kc->kc_nempty--;
+		} else if ((sl = slab_create(kc)) == NULL)
+			return NULL;
+		LIST_INSERT_HEAD(&kc->kc_partial, sl, sl_link);
+	}
+
+	obj = sl->sl_free;
+	sl->sl_free = *obj_link(kc, obj);
+	if (++sl->sl_inuse == kc->kc_nobj) {
+		LIST_REMOVE(sl, sl_link);
+		LIST_INSERT_HEAD(&kc->kc_full, sl, sl_link);
+	}
+	return obj;
+}
+
+// Put an object back on its slab.  The caller holds kc_lock.
+static void
+slab_put(struct KmemCache *kc, void *obj)
+{
+	struct Slab *sl = pa2page(PADDR(obj))->pp_slab;
+	bool wasfull = (sl->sl_inuse == kc->kc_nobj);
+
+	*obj_link(kc, obj) = sl->sl_free;
+	sl->sl_free = obj;
+	if (--sl->sl_inuse == 0) {
+		LIST_REMOVE(sl, sl_link);
+		if (kc->kc_nempty < KMEM_MAXEMPTY) {
+			LIST_INSERT_HEAD(&kc->kc_empty, sl, sl_link);
+			kc->kc_nempty++;
+		} else
+			slab_destroy(kc, sl);
+	} else if (wasfull) {
+		LIST_REMOVE(sl, sl_link);
+		LIST_INSERT_HEAD(&kc->kc_partial, sl, sl_link);
+	}
+}
+
+//
+// Allocate an object from kc.  It is in its constructed state, if kc
+// has a constructor, and uninitialized otherwise.
+// Returns NULL if out of memory.
+//
+void *
+kmem_cache_alloc(struct KmemCache *kc)
+{
+	struct KmemCpuCache *cc = &kc->kc_cpu[cpunum()];
+	void *obj;
+
+	cc->cc_nalloc++;
+	if (cc->cc_count == 0) {
+		cc->cc_nmiss++;
+		spin_lock(&kc->kc_lock);
+		while (cc->cc_count < KMEM_CPU_BATCH
+		       && (obj = slab_get(kc)) != NULL)
+			cc->cc_objs[cc->cc_count++] = obj;
+		spin_unlock(&kc->kc_lock);
+		if (cc->cc_count == 0) {
+			cc->cc_nalloc--;
+			return NULL;
+		}
+	}
+	return cc->cc_objs[--cc->cc_count];
+}
+
+//
+// Return an object to kc.
+//
+void
+kmem_cache_free(struct KmemCache *kc, void *obj)
+{
+	struct KmemCpuCache *cc = &kc->kc_cpu[cpunum()];
+	struct Slab *sl = pa2page(PADDR(obj))->pp_slab;
+	int i;
+
+	if (!sl || sl->sl_cache != kc)
+		panic("kmem_cache_free: %p is not from cache %s", obj,
+		      kc->kc_name);
+
+	cc->cc_nfree++;
+	if (cc->cc_count == KMEM_CPU_NOBJ) {
+		spin_lock(&kc->kc_lock);
+		for (i = 0; i < KMEM_CPU_BATCH; i++)
+			slab_put(kc, cc->cc_objs[--cc->cc_count]);
+		spin_unlock(&kc->kc_lock);
+	}
+	cc->cc_objs[cc->cc_count++] = obj;
+}
+
+//
+// Destroy a cache, all of whose objects must have been freed, and
+// which no other CPU may be using.
+//
+void
+kmem_cache_destroy(struct KmemCache *kc)
+{
+	struct KmemCpuCache *cc;
+	struct Slab *sl;
+
+	spin_lock(&kc->kc_lock);
+	for (cc = kc->kc_cpu; cc < kc->kc_cpu + NCPU; cc++)
+		while (cc->cc_count > 0)
+			slab_put(kc, cc->cc_objs[--cc->cc_count]);
+	if (!LIST_EMPTY(&kc->kc_full) || !LIST_EMPTY(&kc->kc_partial))
+		panic("kmem_cache_destroy: cache %s still in use", kc->kc_name);
+	while ((sl = LIST_FIRST(&kc->kc_empty)) != NULL) {
+		LIST_REMOVE(sl, sl_link);
+		slab_destroy(kc, sl);
+	}
+	spin_unlock(&kc->kc_lock);
+
+	spin_lock(&kmem_lock);
+	LIST_REMOVE(kc, kc_link);
+	spin_unlock(&kmem_lock);
+	kmem_cache_free(&kmem_cache_cache, kc);
+}
+
+// Return how many of kc's objects are allocated, not counting the
+// ones sitting in the per-CPU caches.
+static uint32_t
+kmem_cache_inuse(struct KmemCache *kc)
+{
+	struct Slab *sl;
+	uint32_t inuse = 0;
+	int i;
+
+	spin_lock(&kc->kc_lock);
+	LIST_FOREACH(sl, &kc->kc_full, sl_link)
+		inuse += sl->sl_inuse;
+	LIST_FOREACH(sl, &kc->kc_partial, sl_link)
+		inuse += sl->sl_inuse;
+	spin_unlock(&kc->kc_lock);
+	for (i = 0; i < NCPU; i++)
+		inuse -= kc->kc_cpu[i].cc_count;
+	return inuse;
+}
+
+//
+// Print each cache's size, objects in use out of those in its slabs,
+// slab count and size, and how many allocations the per-CPU caches
+// served without taking the cache's lock.
+//
+void
+kmem_cache_info(void)
+{
+	struct KmemCache *kc;
+	struct KmemCpuCache *cc;
+	uint32_t nalloc, nmiss;
+
+	cprintf("%-20s %6s %8s %8s %6s %5s %6s %5s\n", "cache", "size",
+		"inuse", "objs", "slabs", "pages", "colors", "hit%");
+	spin_lock(&kmem_lock);
+	LIST_FOREACH(kc, &kmem_caches, kc_link) {
+		nalloc = nmiss = 0;
+		for (cc = kc->kc_cpu; cc < kc->kc_cpu + NCPU; cc++) {
+			nalloc += cc->cc_nalloc;
+			nmiss += cc->cc_nmiss;
+		}
+		cprintf("%-20s %6u %8u %8u %6d %5d %6d ", kc->kc_name,
+			kc->kc_size, kmem_cache_inuse(kc),
+			kc->kc_nslab * kc->kc_nobj,
+			kc->kc_nslab, 1 << kc->kc_order, kc->kc_ncolor);
+		if (nalloc)
+			cprintf("%5u\n", (nalloc - nmiss) * 100 / nalloc);
+		else
+			cprintf("%5s\n", "-");
+	}
+	spin_unlock(&kmem_lock);
+}
+
+
+// --------------------------------------------------------------
+// General-purpose allocation.
+// kmalloc() rounds small requests up to one of the size classes below
+// and takes them from that class's object cache.  Anything bigger
+// than the largest class gets its own block of pages from the buddy
+// allocator.  Neither kind has a header: kfree() tells them apart by
+// the struct Page of the address, through pp_slab or PP_KMALLOC.
+// --------------------------------------------------------------
+
+static const size_t kmalloc_sizes[] = {
+	16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048
+};
+#define KMALLOC_NCLASS	(sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+#define KMALLOC_MAX	2048
+#define KMALLOC_QUANTUM	16
+
+static struct KmemCache *kmalloc_caches[KMALLOC_NCLASS];
+
+// The class of a request of n bytes is kmalloc_class[(n - 1) / 16]
+static uint8_t kmalloc_class[KMALLOC_MAX / KMALLOC_QUANTUM];
+
+// Per-CPU counts for kmalloc_info()
+struct KmallocStats {
+	uint32_t ks_nalloc[KMALLOC_NCLASS + 1];	// last is the page blocks
+	uint64_t ks_requested[KMALLOC_NCLASS + 1]; // bytes asked for
+	int32_t ks_npages;			// pages in large blocks
+} __attribute__((aligned(64)));
+
+static struct KmallocStats kmalloc_stats[NCPU];
+
+static void
+kmalloc_init(void)
+{
+	char name[KMEM_NAMELEN];
+	size_t align;
+	int c, i;
+
+	for (c = i = 0; c < KMALLOC_NCLASS; c++) {
+		// Natural alignment, up to a cache line
+		align = MIN(kmalloc_sizes[c] & -kmalloc_sizes[c], KMEM_COLOR);
+		snprintf(name, sizeof(name), "kmalloc-%u", kmalloc_sizes[c]);
+		kmalloc_caches[c] = kmem_cache_create(name, kmalloc_sizes[c],
+						      align, NULL);
+		if (!kmalloc_caches[c])
+			panic("kmalloc_init: can't create %s", name);
+		for (; i * KMALLOC_QUANTUM < kmalloc_sizes[c]; i++)
+			kmalloc_class[i] = c;
+	}
+}
+
+//
+// Allocate n bytes of kernel memory.  Small blocks are aligned to the
+// largest power of two dividing their size class, up to 64 bytes;
+// big ones are page aligned.  Returns NULL if out of memory.
+//
+void *
+kmalloc(size_t n)
+{
+	struct KmallocStats *ks = &kmalloc_stats[cpunum()];
+	struct Page *pp;
+	void *v;
+	int c, order;
+
+	if (n == 0)
+		return NULL;
+	if (n <= KMALLOC_MAX) {
+		c = kmalloc_class[(n - 1) / KMALLOC_QUANTUM];
+		if ((v = kmem_cache_alloc(kmalloc_caches[c])) == NULL)
+			return NULL;
+	} else {
+		c = KMALLOC_NCLASS;
+		for (order = 0; (PGSIZE << order) < n; order++)
+			if (order == PAGE_MAXORDER)
+				return NULL;
+		if ((pp = page_alloc_order(order, 0)) == NULL)
+			return NULL;
+		pp->pp_flags |= PP_KMALLOC;
+		ks->ks_npages += 1 << order;
+		v = page2kva(pp);
+	}
+	ks->ks_nalloc[c]++;
+	ks->ks_requested[c] += n;
+	return v;
+}
+
+//
+// Free memory from kmalloc().
+//
+void
+kfree(void *v)
+{
+	struct Page *pp;
+
+	if (v == NULL)
+		return;
+	pp = pa2page(PADDR(v));
+	if (pp->pp_slab) {
+		kmem_cache_free(pp->pp_slab->sl_cache, v);
+		return;
+	}
+	if (!(pp->pp_flags & PP_KMALLOC) || PGOFF(v))
+		panic("kfree: %p is not from kmalloc", v);
+	pp->pp_flags &= ~PP_KMALLOC;
+	kmalloc_stats[cpunum()].ks_npages -= 1 << pp->pp_order;
+	page_free_order(pp, pp->pp_order);
+}
+
+//
+// Report how well kmalloc() uses memory.  Internal fragmentation is
+// the rounding up of requests to their size class, over every
+// allocation so far.  External fragmentation is what the class's
+// slabs hold beyond the live objects: free objects and the space
+// left over in each slab.
+//
+void
+kmalloc_info(void)
+{
+	struct KmemCache *kc;
+	uint64_t req, used, slabbytes, inuse, tinuse = 0, tslab = 0;
+	uint32_t nalloc, live;
+	int32_t npages = 0;
+	int c, i;
+
+	cprintf("%-8s %8s %10s %10s %10s %9s %9s\n", "class", "live",
+		"allocs", "live KB", "slab KB", "internal", "external");
+	for (c = 0; c < KMALLOC_NCLASS; c++) {
+		kc = kmalloc_caches[c];
+		nalloc = 0;
+		req = 0;
+		for (i = 0; i < NCPU; i++) {
+			nalloc += kmalloc_stats[i].ks_nalloc[c];
+			req += kmalloc_stats[i].ks_requested[c];
+		}
+		live = kmem_cache_inuse(kc);
+		inuse = (uint64_t) live * kc->kc_size;
+		slabbytes = (uint64_t) kc->kc_nslab * (PGSIZE << kc->kc_order);
+		used = (uint64_t) nalloc * kc->kc_size;
+		tinuse += inuse;
+		tslab += slabbytes;
+		cprintf("%-8u %8u %10u %10llu %10llu %8llu%% %8llu%%\n",
+			kc->kc_size, live, nalloc, inuse / 1024, slabbytes / 1024,
+			used ? (used - req) * 100 / used : 0,
+			slabbytes ? (slabbytes - inuse) * 100 / slabbytes : 0);
+	}
+
+	nalloc = 0;
+	for (i = 0; i < NCPU; i++) {
+		nalloc += kmalloc_stats[i].ks_nalloc[KMALLOC_NCLASS];
+		npages += kmalloc_stats[i].ks_npages;
+	}
+	cprintf("%-8s %8s %10u %10u %10s %9s %9s\n", "pages", "-", nalloc,
+		npages * PGSIZE / 1024, "-", "-", "-");
+	cprintf("small objects: %lluK live in %lluK of slabs\n",
+		tinuse / 1024, tslab / 1024);
+}
+
+#define CHECK_NOBJ	300
+#define CHECK_MAGIC	0x6b6d656d		// "kmem"
+
+struct CheckObj {
+	uint32_t co_magic;
+	char co_data[96];
+};
+
+static void
+check_ctor(void *obj)
+{
+	struct CheckObj *co = obj;
+
+	co->co_magic = CHECK_MAGIC;
+	memset(co->co_data, 0, sizeof(co->co_data));
+}
+
+//
+// Check the object caches: objects are constructed, aligned, and
+// disjoint; slabs get different colors; and the cache gives its memory
+// back when destroyed.
+//
+static void
+check_kmem(void)
+{
+	static struct CheckObj *obj[CHECK_NOBJ];
+	struct KmemCache *kc;
+	struct Slab *sl;
+	uint32_t color, colors = 0;
+	int i, j, n;
+
+	kc = kmem_cache_create("check", sizeof(struct CheckObj), 32,
+			       check_ctor);
+	assert(kc);
+	assert(kc->kc_size >= sizeof(struct CheckObj) + sizeof(void *));
+
+	for (i = 0; i < CHECK_NOBJ; i++) {
+		obj[i] = kmem_cache_alloc(kc);
+		assert(obj[i]);
+		assert(((uintptr_t) obj[i] & 31) == 0);
+		assert(obj[i]->co_magic == CHECK_MAGIC);
+		for (j = 0; j < sizeof(obj[i]->co_data); j++)
+			assert(obj[i]->co_data[j] == 0);
+		// scribble on it; the link after the object must survive
+		memset(obj[i]->co_data, i, sizeof(obj[i]->co_data));
+	}
+	for (i = 0; i < CHECK_NOBJ; i++) {
+		for (j = 0; j < sizeof(obj[i]->co_data); j++)
+			assert(obj[i]->co_data[j] == (char) i);
+		for (j = i + 1; j < CHECK_NOBJ; j++)
+			assert(obj[i] != obj[j]);
+	}
+	assert(kc->kc_nslab >= CHECK_NOBJ / kc->kc_nobj);
+
+	// Slabs start their objects at different offsets (colors)
+	for (i = 0; i < CHECK_NOBJ; i++) {
+		sl = pa2page(PADDR(obj[i]))->pp_slab;
+		assert(sl && sl->sl_cache == kc);
+		color = ((uintptr_t) obj[i]
+			 - ROUNDUP((uintptr_t) (sl + 1), kc->kc_align))
+			% kc->kc_size / KMEM_COLOR;
+		assert(color < kc->kc_ncolor);
+		colors |= 1 << (color % 32);
+	}
+	for (i = n = 0; i < 32; i++)
+		n += (colors >> i) & 1;
+	assert(kc->kc_ncolor > 32 || n == MIN(kc->kc_ncolor, kc->kc_nslab));
+
+	// Give them back constructed, and get them back again
+	for (i = 0; i < CHECK_NOBJ; i++) {
+		memset(obj[i]->co_data, 0, sizeof(obj[i]->co_data));
+		kmem_cache_free(kc, obj[i]);
+	}
+	for (i = 0; i < CHECK_NOBJ; i++) {
+		obj[i] = kmem_cache_alloc(kc);
+		assert(obj[i] && obj[i]->co_magic == CHECK_MAGIC);
+	}
+	for (i = 0; i < CHECK_NOBJ; i++)
+		kmem_cache_free(kc, obj[i]);
+
+	kmem_cache_destroy(kc);
+	cprintf("check_kmem() succeeded!\n");
+}
+
+//
+// Check kmalloc() and kfree() across the size classes and into the
+// page allocator.
+//
+static void
+check_kmalloc(void)
+{
+	static const size_t sizes[] = {
+		1, 16, 17, 96, 100, 200, 1000, 2048, 2049, 5000, 70000
+	};
+	static uint8_t *v[sizeof(sizes) / sizeof(sizes[0])][4];
+	size_t n;
+	int i, j, k;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		for (j = 0; j < 4; j++) {
+			n = sizes[i];
+			v[i][j] = kmalloc(n);
+			assert(v[i][j]);
+			if (n > KMALLOC_MAX)
+				assert(PGOFF(v[i][j]) == 0);
+			else
+				assert(((uintptr_t) v[i][j] & 15) == 0
+				       || n <= 16);
+			memset(v[i][j], i * 4 + j, n);
+		}
+
+	// Nothing overlaps
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		for (j = 0; j < 4; j++)
+			for (k = 0; k < sizes[i]; k++)
+				assert(v[i][j][k] == i * 4 + j);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		for (j = 0; j < 4; j++)
+			kfree(v[i][j]);
+
+	assert(kmalloc(0) == NULL);
+	assert(kmalloc((PGSIZE << PAGE_MAXORDER) + 1) == NULL);
+	kfree(NULL);
+
+	cprintf("check_kmalloc() succeeded!\n");
+}
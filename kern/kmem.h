@@ -0,0 +1,79 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KMEM_H
+#define JOS_KERN_KMEM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/queue.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+#define KMEM_NAMELEN	24
+#define KMEM_CPU_NOBJ	16		// objects in each CPU's cache
+#define KMEM_CPU_BATCH	(KMEM_CPU_NOBJ / 2)	// objects per refill/flush
+
+LIST_HEAD(Slab_list, Slab);
+LIST_HEAD(KmemCache_list, KmemCache);
+
+// A slab: 2^kc_order contiguous pages, holding this header followed by
+// kc_nobj objects.  Free objects are chained through their first word.
+struct Slab {
+	LIST_ENTRY(Slab) sl_link;	// on one of the cache's slab lists
+	struct KmemCache *sl_cache;
+	void *sl_free;			// first free object
+	int sl_inuse;			// objects handed out (or cached per-CPU)
+};
+
+// Objects a CPU can allocate and free without taking kc_lock
+struct KmemCpuCache {
+	int cc_count;
+	void *cc_objs[KMEM_CPU_NOBJ];
+
+	// Statistics
+	uint32_t cc_nalloc;		// allocations
+	uint32_t cc_nfree;		// frees
+	uint32_t cc_nmiss;		// allocations that had to take kc_lock
+} __attribute__((aligned(64)));
+
+// An object cache: slabs of same-sized objects, all constructed by
+// kc_ctor when their slab is made.  Freed objects must be returned in
+// their constructed state.
+struct KmemCache {
+	char kc_name[KMEM_NAMELEN];
+	size_t kc_size;			// object size, rounded up to kc_align
+	size_t kc_align;
+	void (*kc_ctor)(void *obj);
+	int kc_order;			// slabs are 2^kc_order pages
+	int kc_nobj;			// objects per slab
+	int kc_ncolor;			// distinct first-object offsets
+	int kc_color;			// offset of the next slab, in KMEM_COLOR units
+
+	struct spinlock kc_lock;	// protects all below except kc_cpu
+	struct Slab_list kc_full;
+	struct Slab_list kc_partial;
+	struct Slab_list kc_empty;
+	int kc_nslab;
+	int kc_nempty;
+
+	struct KmemCpuCache kc_cpu[NCPU];
+	LIST_ENTRY(KmemCache) kc_link;	// on kmem_caches
+};
+
+extern struct KmemCache_list kmem_caches;
+
+void	kmem_init(void);
+struct KmemCache *kmem_cache_create(const char *name, size_t size,
+				    size_t align, void (*ctor)(void *));
+void	kmem_cache_destroy(struct KmemCache *kc);
+void	*kmem_cache_alloc(struct KmemCache *kc);
+void	kmem_cache_free(struct KmemCache *kc, void *obj);
+void	kmem_cache_info(void);
+
+void	*kmalloc(size_t n);
+void	kfree(void *v);
+void	kmalloc_info(void);
+
+#endif	// !JOS_KERN_KMEM_H
@@ -6,10 +6,20 @@
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/bootinfo.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/kclock.h>
+#include <kern/initrd.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/kmem.h>
+#include <kern/env.h>
+#include <kern/sched.h>
+#include <kern/fpu.h>
+#include <kern/syscall.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -25,6 +35,23 @@ static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
 	{ "backtrace", "Backtrace the runtime environment", mon_backtrace},
+	{ "boottime", "Display how long each boot phase took", mon_boottime },
+	{ "initrd", "List the files in the initial RAM disk", mon_initrd },
+	{ "tlbbench", "Time CR3 switches with and without global pages", mon_tlbbench },
+	{ "cpus", "List the CPUs and how long each took to start", mon_cpus },
+	{ "pagebench", "Time the page allocator at each block order", mon_pagebench },
+	{ "magbench", "Page allocations per second on 1, 2 and 4 CPUs", mon_magbench },
+	{ "slabinfo", "Display object cache statistics", mon_slabinfo },
+	{ "kmallocinfo", "Display kmalloc fragmentation by size class", mon_kmallocinfo },
+	{ "zeropool", "Display pre-zeroed page pool statistics", mon_zeropool },
+	{ "forkbench", "Time fork+exit with eager and copy-on-write copying", mon_forkbench },
+	{ "envs", "Display environments and their resident memory", mon_envs },
+	{ "umembench", "Time user buffer checks of 4KB, 1MB and 16MB", mon_umembench },
+	{ "schedbench", "Time scheduling decisions with 10, 100 and 1000 envs", mon_schedbench },
+	{ "fanoutbench", "Run a CPU-bound fan-out on 1, 2, 4 and 8 CPUs", mon_fanoutbench },
+	{ "fpubench", "Time context switches with eager and lazy FPU switching", mon_fpubench },
+	{ "syscallbench", "Time null system calls through int and sysenter", mon_syscallbench },
+	{ "batchbench", "Time page mapping calls one at a time and batched", mon_batchbench },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -113,6 +140,275 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+// Boot phase i runs from timeline stamp i-1 to stamp i.
+static const char *boot_phases[BI_NTSC] = {
+	[BI_TSC_A20]		= "A20 enable",
+	[BI_TSC_E820]		= "E820 memory map",
+	[BI_TSC_PROTMODE]	= "GDT, protected mode switch",
+	[BI_TSC_LOADER]		= "read second-stage loader",
+	[BI_TSC_KERNHDR]	= "probe disk, read ELF header",
+	[BI_TSC_KERNLOADED]	= "load kernel segments",
+	[BI_TSC_ENTRY]		= "jump to kernel",
+	[BI_TSC_PAGING]		= "enable paging",
+	[BI_TSC_INIT]		= "reach i386_init",
+	[BI_TSC_CONS]		= "cons_init",
+};
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+	uint64_t *tsc = bi->bi_tsc, d;
+	int i;
+
+	if (bi->bi_magic != BOOTINFO_MAGIC) {
+		cprintf("No boot timeline: not booted by the JOS boot loader\n");
+		return 0;
+	}
+
+	cprintf("TSC runs at %llu MHz\n", tsc_freq() / 1000000);
+	cprintf("%-28s %12s %10s\n", "phase", "cycles", "us");
+	for (i = 1; i < BI_NTSC; i++) {
+		if (!tsc[i - 1] || !tsc[i]) {
+			cprintf("%-28s %12s %10s\n", boot_phases[i], "-", "-");
+			continue;
+		}
+		d = tsc[i] - tsc[i - 1];
+		cprintf("%-28s %12llu %10llu\n", boot_phases[i], d, tsc_to_us(d));
+	}
+	if (tsc[BI_TSC_START] && tsc[BI_TSC_CONS]) {
+		d = tsc[BI_TSC_CONS] - tsc[BI_TSC_START];
+		cprintf("%-28s %12llu %10llu\n", "total", d, tsc_to_us(d));
+	}
+	return 0;
+}
+
+int
+mon_initrd(int argc, char **argv, struct Trapframe *tf)
+{
+	const struct Initrdent *ie;
+	uint32_t i;
+
+	if (!initrd) {
+		cprintf("No initrd\n");
+		return 0;
+	}
+	for (i = 0; i < initrd->ir_nfiles; i++) {
+		ie = &initrd->ir_files[i];
+		cprintf("%08x %8u %s\n", (uint8_t *) initrd + ie->ie_off - KERNBASE,
+			ie->ie_size, ie->ie_name);
+	}
+	return 0;
+}
+
+int
+mon_tlbbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 100000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: tlbbench [iterations]\n");
+		return 0;
+	}
+	pmap_cr3_bench(niter);
+	return 0;
+}
+
+int
+mon_cpus(int argc, char **argv, struct Trapframe *tf)
+{
+	static const char *status[] = {
+		[CPU_UNUSED]	= "offline",
+		[CPU_STARTED]	= "online",
+		[CPU_HALTED]	= "halted",
+	};
+	struct CpuInfo *c;
+	uint64_t d;
+
+	cprintf("%-4s %-6s %-8s %12s %10s\n", "cpu", "apic", "status",
+		"cycles", "us");
+	for (c = cpus; c < cpus + ncpu; c++) {
+		cprintf("%-4d %-6d %-8s ", c->cpu_id, c->cpu_apicid,
+			status[c->cpu_status]);
+		if (c == bootcpu)
+			cprintf("%12s %10s\n", "boot", "-");
+		else if (c->cpu_status == CPU_UNUSED || !c->cpu_started_tsc)
+			cprintf("%12s %10s\n", "-", "-");
+		else {
+			// The time from the BSP's INIT IPI to the AP's
+			// report, which assumes the TSCs are in sync.
+			d = c->cpu_started_tsc - c->cpu_startap_tsc;
+			cprintf("%12llu %10llu\n", d, tsc_to_us(d));
+		}
+	}
+	return 0;
+}
+
+int
+mon_pagebench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 1000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: pagebench [iterations]\n");
+		return 0;
+	}
+	page_alloc_bench(niter);
+	return 0;
+}
+
+int
+mon_magbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 10000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: magbench [iterations]\n");
+		return 0;
+	}
+	page_mag_bench(niter);
+	return 0;
+}
+
+int
+mon_slabinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	kmem_cache_info();
+	return 0;
+}
+
+int
+mon_kmallocinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	kmalloc_info();
+	return 0;
+}
+
+int
+mon_zeropool(int argc, char **argv, struct Trapframe *tf)
+{
+	page_zero_info();
+	return 0;
+}
+
+int
+mon_forkbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 4;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: forkbench [iterations]\n");
+		return 0;
+	}
+	pmap_fork_bench(niter);
+	return 0;
+}
+
+int
+mon_envs(int argc, char **argv, struct Trapframe *tf)
+{
+	env_info();
+	return 0;
+}
+
+int
+mon_umembench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 100;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: umembench [iterations]\n");
+		return 0;
+	}
+	pmap_umem_bench(niter);
+	return 0;
+}
+
+int
+mon_schedbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 10000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: schedbench [iterations]\n");
+		return 0;
+	}
+	sched_bench(niter);
+	return 0;
+}
+
+int
+mon_fanoutbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int nquanta = 50;
+
+	if (argc > 1)
+		nquanta = strtol(argv[1], NULL, 0);
+	if (nquanta <= 0) {
+		cprintf("Usage: fanoutbench [quanta per job]\n");
+		return 0;
+	}
+	sched_fanout_bench(nquanta);
+	return 0;
+}
+
+int
+mon_fpubench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 10000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: fpubench [iterations]\n");
+		return 0;
+	}
+	fpu_bench(niter);
+	return 0;
+}
+
+int
+mon_syscallbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 100000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: syscallbench [iterations]\n");
+		return 0;
+	}
+	syscall_bench(niter);
+	return 0;
+}
+
+int
+mon_batchbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int niter = 10000;
+
+	if (argc > 1)
+		niter = strtol(argv[1], NULL, 0);
+	if (niter <= 0) {
+		cprintf("Usage: batchbench [pages]\n");
+		return 0;
+	}
+	batch_bench(niter);
+	return 0;
+}
+
 
 /***** Kernel monitor command interpreter *****/
 
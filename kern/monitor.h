@@ -15,5 +15,22 @@ void monitor(struct Trapframe *tf);
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_boottime(int argc, char **argv, struct Trapframe *tf);
+int mon_initrd(int argc, char **argv, struct Trapframe *tf);
+int mon_tlbbench(int argc, char **argv, struct Trapframe *tf);
+int mon_cpus(int argc, char **argv, struct Trapframe *tf);
+int mon_pagebench(int argc, char **argv, struct Trapframe *tf);
+int mon_magbench(int argc, char **argv, struct Trapframe *tf);
+int mon_slabinfo(int argc, char **argv, struct Trapframe *tf);
+int mon_kmallocinfo(int argc, char **argv, struct Trapframe *tf);
+int mon_zeropool(int argc, char **argv, struct Trapframe *tf);
+int mon_forkbench(int argc, char **argv, struct Trapframe *tf);
+int mon_envs(int argc, char **argv, struct Trapframe *tf);
+int mon_umembench(int argc, char **argv, struct Trapframe *tf);
+int mon_schedbench(int argc, char **argv, struct Trapframe *tf);
+int mon_fanoutbench(int argc, char **argv, struct Trapframe *tf);
+int mon_fpubench(int argc, char **argv, struct Trapframe *tf);
+int mon_syscallbench(int argc, char **argv, struct Trapframe *tf);
+int mon_batchbench(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -0,0 +1,361 @@
+// Search for and parse the multiprocessor configuration table
+// See http://developer.intel.com/design/pentium/datashts/24201606.pdf
+// If there is none, fall back on the ACPI MADT.
+
+#include <inc/types.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/assert.h>
+
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+struct CpuInfo cpus[NCPU];
+struct CpuInfo *bootcpu;
+int ismp;
+int ncpu;
+
+// Per-CPU kernel stacks
+unsigned char percpu_kstacks[NCPU][KSTKSIZE]
+__attribute__ ((aligned(PGSIZE)));
+
+
+// See MultiProcessor Specification Version 1.[14]
+
+struct mp {             // floating pointer [MP 4.1]
+	uint8_t signature[4];           // "_MP_"
+	physaddr_t physaddr;            // phys addr of MP config table
+	uint8_t length;                 // 1
+	uint8_t specrev;                // [14]
+	uint8_t checksum;               // all bytes must add up to 0
+	uint8_t type;                   // MP system config type
+	uint8_t imcrp;
+	uint8_t reserved[3];
+} __attribute__((__packed__));
+
+struct mpconf {         // configuration table header [MP 4.2]
+	uint8_t signature[4];           // "PCMP"
+	uint16_t length;                // total table length
+	uint8_t version;                // [14]
+	uint8_t checksum;               // all bytes must add up to 0
+	uint8_t product[20];            // product id
+	physaddr_t oemtable;            // OEM table pointer
+	uint16_t oemlength;             // OEM table length
+	uint16_t entry;                 // entry count
+	physaddr_t lapicaddr;           // address of local APIC
+	uint16_t xlength;               // extended table length
+	uint8_t xchecksum;              // extended table checksum
+	uint8_t reserved;
+	uint8_t entries[0];             // table entries
+} __attribute__((__packed__));
+
+struct mpproc {         // processor table entry [MP 4.3.1]
+	uint8_t type;                   // entry type (0)
+	uint8_t apicid;                 // local APIC id
+	uint8_t version;                // local APIC version
+	uint8_t flags;                  // CPU flags
+	uint8_t signature[4];           // CPU signature
+	uint32_t feature;               // feature flags from CPUID instruction
+	uint8_t reserved[8];
+} __attribute__((__packed__));
+
+// mpproc flags
+#define MPPROC_BOOT 0x02                // This mpproc is the bootstrap processor
+
+// Table entry types
+#define MPPROC    0x00  // One per processor
+#define MPBUS     0x01  // One per bus
+#define MPIOAPIC  0x02  // One per I/O APIC
+#define MPIOINTR  0x03  // One per bus interrupt source
+#define MPLINTR   0x04  // One per system interrupt source
+
+
+// See Advanced Configuration and Power Interface Specification 1.0
+
+struct rsdp {           // root system description pointer [ACPI 5.2.4]
+	uint8_t signature[8];           // "RSD PTR "
+	uint8_t checksum;               // first 20 bytes must add up to 0
+	uint8_t oemid[6];
+	uint8_t revision;
+	physaddr_t rsdt;                // phys addr of the RSDT
+} __attribute__((__packed__));
+
+struct sdthdr {         // system description table header [ACPI 5.2.5]
+	uint8_t signature[4];
+	uint32_t length;                // total table length
+	uint8_t revision;
+	uint8_t checksum;               // all bytes must add up to 0
+	uint8_t oemid[6];
+	uint8_t oemtableid[8];
+	uint32_t oemrevision;
+	uint32_t creatorid;
+	uint32_t creatorrevision;
+} __attribute__((__packed__));
+
+struct madt {           // multiple APIC description table [ACPI 5.2.8]
+	struct sdthdr hdr;              // signature "APIC"
+	physaddr_t lapicaddr;           // address of local APIC
+	uint32_t flags;
+	uint8_t entries[0];             // variable-length entries
+} __attribute__((__packed__));
+
+struct madtlapic {      // processor local APIC entry [ACPI 5.2.8.1]
+	uint8_t type;                   // entry type (0)
+	uint8_t length;                 // 8
+	uint8_t acpiid;                 // ACPI processor id
+	uint8_t apicid;                 // local APIC id
+	uint32_t flags;
+} __attribute__((__packed__));
+
+#define MADT_LAPIC		0x00    // madt entry type of a processor
+#define MADT_LAPIC_ENABLED	0x01    // madtlapic flags: usable processor
+
+
+static uint8_t
+sum(void *addr, int len)
+{
+	int i, sum;
+
+	sum = 0;
+	for (i = 0; i < len; i++)
+		sum += ((uint8_t *)addr)[i];
+	return sum;
+}
+
+// Look for an MP structure in the len bytes at physical address addr.
+static struct mp *
+mpsearch1(physaddr_t a, int len)
+{
+	struct mp *mp = KADDR(a), *end = KADDR(a + len);
+
+	for (; mp < end; mp++)
+		if (memcmp(mp->signature, "_MP_", 4) == 0 &&
+		    sum(mp, sizeof(*mp)) == 0)
+			return mp;
+	return NULL;
+}
+
+// Search for the MP Floating Pointer Structure, which according to
+// [MP 4] is in one of the following three locations:
+// 1) in the first KB of the EBDA;
+// 2) if there is no EBDA, in the last KB of system base memory;
+// 3) in the BIOS ROM between 0xE0000 and 0xFFFFF.
+static struct mp *
+mpsearch(void)
+{
+	uint8_t *bda;
+	uint32_t p;
+	struct mp *mp;
+
+	static_assert(sizeof(*mp) == 16);
+
+	// The BIOS data area lives in 16-bit segment 0x40.
+	bda = (uint8_t *) KADDR(0x40 << 4);
+
+	// [MP 4] The 16-bit segment of the EBDA is in the two bytes
+	// starting at byte 0x0E of the BDA.  0 if not present.
+	if ((p = *(uint16_t *) (bda + 0x0E))) {
+		p <<= 4;	// Translate from segment to PA
+		if ((mp = mpsearch1(p, 1024)))
+			return mp;
+	} else {
+		// The size of base memory, in KB is in the two bytes
+		// starting at 0x13 of the BDA.
+		p = *(uint16_t *) (bda + 0x13) * 1024;
+		if ((mp = mpsearch1(p - 1024, 1024)))
+			return mp;
+	}
+	return mpsearch1(0xF0000, 0x10000);
+}
+
+// Search for an MP configuration table.  For now, don't accept the
+// default configurations (physaddr == 0).
+// Check for the correct signature, checksum, and version.
+static struct mpconf *
+mpconfig(struct mp **pmp)
+{
+	struct mpconf *conf;
+	struct mp *mp;
+
+	if ((mp = mpsearch()) == 0)
+		return NULL;
+	if (mp->physaddr == 0 || mp->type != 0) {
+		cprintf("SMP: Default configurations not implemented\n");
+		return NULL;
+	}
+	conf = (struct mpconf *) KADDR(mp->physaddr);
+	if (memcmp(conf, "PCMP", 4) != 0) {
+		cprintf("SMP: Incorrect MP configuration table signature\n");
+		return NULL;
+	}
+	if (sum(conf, conf->length) != 0) {
+		cprintf("SMP: Bad MP configuration checksum\n");
+		return NULL;
+	}
+	if (conf->version != 1 && conf->version != 4) {
+		cprintf("SMP: Unsupported MP version %d\n", conf->version);
+		return NULL;
+	}
+	if ((sum((uint8_t *)conf + conf->length, conf->xlength) + conf->xchecksum) & 0xff) {
+		cprintf("SMP: Bad MP configuration extended checksum\n");
+		return NULL;
+	}
+	*pmp = mp;
+	return conf;
+}
+
+// Add a CPU with local APIC id 'apicid' to cpus[].
+static void
+cpu_add(uint8_t apicid, bool isboot)
+{
+	if (ncpu == NCPU) {
+		cprintf("SMP: too many CPUs, CPU %d disabled\n", apicid);
+		return;
+	}
+	if (isboot)
+		bootcpu = &cpus[ncpu];
+	cpus[ncpu].cpu_id = ncpu;
+	cpus[ncpu].cpu_apicid = apicid;
+	ncpu++;
+}
+
+// ACPI tables can live anywhere in physical memory, often in the
+// reserved area just past the top of RAM, so map them as MMIO if
+// they aren't in the KERNBASE mapping.
+static void *
+acpi_map(physaddr_t pa, size_t len)
+{
+	if (pa + len <= npage * PGSIZE)
+		return KADDR(pa);
+	return mmio_map_region(pa, len);
+}
+
+// Search for the ACPI Root System Description Pointer, which
+// according to [ACPI 5.2.4.1] is on a 16-byte boundary in the first
+// KB of the EBDA or in the BIOS ROM between 0xE0000 and 0xFFFFF.
+static struct rsdp *
+rsdpsearch(void)
+{
+	physaddr_t ranges[2][2] = { { 0, 1024 }, { 0xE0000, 0x20000 } };
+	physaddr_t a;
+	int i;
+
+	ranges[0][0] = *(uint16_t *) KADDR(0x40E) << 4;
+	for (i = 0; i < 2; i++) {
+		if (!ranges[i][0])
+			continue;
+		for (a = ranges[i][0]; a < ranges[i][0] + ranges[i][1]; a += 16)
+			if (memcmp(KADDR(a), "RSD PTR ", 8) == 0 &&
+			    sum(KADDR(a), 20) == 0)
+				return KADDR(a);
+	}
+	return NULL;
+}
+
+// Find the CPUs from the ACPI MADT.  Returns 0 on success.
+static int
+acpi_init(void)
+{
+	struct rsdp *rsdp;
+	struct sdthdr *rsdt, *hdr;
+	struct madt *madt = NULL;
+	struct madtlapic *lp;
+	physaddr_t *tables;
+	uint8_t *p, *end, bootid;
+	int i, n;
+
+	if ((rsdp = rsdpsearch()) == NULL)
+		return -1;
+	rsdt = acpi_map(rsdp->rsdt, sizeof(*rsdt));
+	rsdt = acpi_map(rsdp->rsdt, rsdt->length);
+	if (memcmp(rsdt->signature, "RSDT", 4) != 0 || sum(rsdt, rsdt->length)) {
+		cprintf("SMP: Bad ACPI RSDT\n");
+		return -1;
+	}
+
+	tables = (physaddr_t *) (rsdt + 1);
+	n = (rsdt->length - sizeof(*rsdt)) / sizeof(tables[0]);
+	for (i = 0; i < n && !madt; i++) {
+		hdr = acpi_map(tables[i], sizeof(*hdr));
+		if (memcmp(hdr->signature, "APIC", 4) == 0)
+			madt = acpi_map(tables[i], hdr->length);
+	}
+	if (!madt || sum(madt, madt->hdr.length)) {
+		cprintf("SMP: No usable ACPI MADT\n");
+		return -1;
+	}
+
+	lapicaddr = madt->lapicaddr;
+	// The MADT doesn't say which CPU is the BSP: it's us.
+	bootid = *(volatile uint32_t *) acpi_map(lapicaddr + 0x20, 4) >> 24;
+	p = madt->entries;
+	end = (uint8_t *) madt + madt->hdr.length;
+	for (; p + 2 <= end && p[1] >= 2; p += p[1]) {
+		lp = (struct madtlapic *) p;
+		if (lp->type == MADT_LAPIC && (lp->flags & MADT_LAPIC_ENABLED))
+			cpu_add(lp->apicid, lp->apicid == bootid);
+	}
+	return ncpu > 0 ? 0 : -1;
+}
+
+void
+mp_init(void)
+{
+	struct mp *mp;
+	struct mpconf *conf;
+	struct mpproc *proc;
+	uint8_t *p;
+	unsigned int i;
+	const char *source = "MP";
+
+	bootcpu = &cpus[0];
+	if ((conf = mpconfig(&mp)) == 0) {
+		ismp = (acpi_init() == 0);
+		source = "ACPI";
+		goto done;
+	}
+	ismp = 1;
+	lapicaddr = conf->lapicaddr;
+
+	for (p = conf->entries, i = 0; i < conf->entry; i++) {
+		switch (*p) {
+		case MPPROC:
+			proc = (struct mpproc *)p;
+			cpu_add(proc->apicid, proc->flags & MPPROC_BOOT);
+			p += sizeof(struct mpproc);
+			continue;
+		case MPBUS:
+		case MPIOAPIC:
+		case MPIOINTR:
+		case MPLINTR:
+			p += 8;
+			continue;
+		default:
+			cprintf("mpinit: unknown config type %x\n", *p);
+			ismp = 0;
+			i = conf->entry;
+		}
+	}
+
+	if (mp->imcrp) {
+		// [MP 3.2.6.1] If the hardware implements PIC mode,
+		// switch to getting interrupts from the LAPIC.
+		cprintf("SMP: Setting IMCR to switch from PIC mode to symmetric I/O mode\n");
+		outb(0x22, 0x70);   // Select IMCR
+		outb(0x23, inb(0x23) | 1);  // Mask external interrupts.
+	}
+
+done:
+	bootcpu->cpu_status = CPU_STARTED;
+	if (!ismp) {
+		// Didn't like what we found; fall back to no MP.
+		ncpu = 1;
+		lapicaddr = 0;
+		cprintf("SMP: configuration not found, SMP disabled\n");
+		return;
+	}
+	cprintf("SMP: CPU %d found %d CPU(s) (%s)\n", bootcpu->cpu_id, ncpu, source);
+}
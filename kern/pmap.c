@@ -0,0 +1,2194 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/bootinfo.h>
+
+#include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/syscall.h>
+#include <kern/e820.h>
+#include <kern/cpu.h>
+#include <kern/kclock.h>
+#include <kern/spinlock.h>
+
+// The most physical memory we can use: all of it has to fit in the
+// mapping at KERNBASE.
+#define MAXPHYSMEM	(0 - KERNBASE)
+
+// These variables are set by i386_detect_memory()
+size_t npage;			// Amount of physical memory (in pages)
+
+// These variables are set in i386_vm_init()
+pde_t* boot_pgdir;		// Virtual address of boot time page directory
+physaddr_t boot_cr3;		// Physical address of boot time page directory
+static char* boot_freemem;	// Pointer to next byte of free mem
+
+struct Page* pages;		// Virtual address of physical page array
+
+// The buddy allocator's free lists: page_free_list[o] holds the free
+// blocks of 2^o pages, each naturally aligned (its first page number
+// is a multiple of 2^o).
+static struct Page_list page_free_list[PAGE_MAXORDER + 1];
+static size_t page_nfree;	// Free pages, in blocks of any order
+static struct spinlock page_lock;	// protects the two above
+
+// Each CPU keeps a magazine of free single pages in front of the free
+// lists, so that the common page_alloc() and page_free() take no lock
+// and touch no cache lines other CPUs are using.  An empty magazine is
+// refilled, and a full one drained, PAGE_MAGBATCH pages at a time.
+// The kernel is not preemptive and interrupt handlers don't allocate,
+// so a CPU's own magazine needs no lock.
+#define PAGE_MAGSIZE	32
+#define PAGE_MAGBATCH	(PAGE_MAGSIZE / 2)
+
+struct PageMagazine {
+	int pm_count;
+	struct Page *pm_pages[PAGE_MAGSIZE];
+	uint32_t pm_refills;	// trips to the free lists for more pages
+	uint32_t pm_drains;	// trips to the free lists with extra pages
+	uint32_t pm_zerohit;	// ALLOC_ZERO served from the zero pool
+	uint32_t pm_zeromiss;	// ALLOC_ZERO that had to zero the page
+	uint64_t pm_zerocycles;	// spent zeroing on those misses
+} __attribute__((aligned(64)));	// one CPU's cache lines only
+
+static struct PageMagazine page_mags[NCPU];
+static bool page_nomag;		// bypass the magazines (for benchmarking)
+
+// A pool of free pages that are already zero, refilled by
+// page_zero_idle() when a CPU has nothing else to do, so that
+// page_alloc(ALLOC_ZERO) rarely has to clear 4KB while someone waits.
+#define ZERO_POOL_MAX	256		// pages (1MB)
+#define ZERO_POOL_RESERVE (4 * ZERO_POOL_MAX)	// free pages to leave alone
+
+static struct Page_list zero_pool;
+static volatile int zero_pool_count;
+static struct spinlock zero_lock;	// protects the pool and the two below
+static uint32_t zero_nfilled;		// pages zeroed while idle
+static uint64_t zero_fillcycles;	// and the cycles that took
+
+// A second address space for the CR3 switch benchmark
+static pde_t bench_pgdir[NPDENTRIES] __attribute__((aligned(PGSIZE)));
+
+// Global descriptor table.
+//
+// The kernel and user segments are identical (except for the DPL).
+// To load the SS register, the CPL must equal the DPL.  Thus,
+// we must duplicate the segments for the user and the kernel.
+//
+// Each CPU gets its own TSS descriptor, starting at GD_TSS0.
+//
+struct Segdesc gdt[(GD_TSS0 >> 3) + NCPU] =
+{
+	// 0x0 - unused (always faults -- for trapping NULL far pointers)
+	SEG_NULL,
+
+	// 0x8 - kernel code segment
+	[GD_KT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 0),
+
+	// 0x10 - kernel data segment
+	[GD_KD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 0),
+
+	// 0x18 - user code segment
+	[GD_UT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 3),
+
+	// 0x20 - user data segment
+	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
+
+	// 0x28 onwards - one tss per CPU, initialized in seg_init_percpu()
+	[GD_TSS0 >> 3] = SEG_NULL
+};
+
+struct Pseudodesc gdt_pd = {
+	sizeof(gdt) - 1, (unsigned long) gdt
+};
+
+// Next free virtual address in [MMIOBASE, MMIOLIM)
+static uintptr_t mmio_next = MMIOBASE;
+
+static pte_t *boot_pgdir_walk(pde_t *pgdir, uintptr_t la);
+static void check_boot_pgdir(void);
+static void check_page_alloc(void);
+static void check_page_mag(void);
+static void check_zero_pool(void);
+static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
+static int check_va_perm(pde_t *pgdir, uintptr_t va);
+
+// Find out how much memory the machine has from the map e820_init()
+// built: everything up to the end of the highest usable range, as
+// far as it fits at KERNBASE.
+static void
+i386_detect_memory(void)
+{
+	physaddr_t maxpa;
+
+	assert(nmemranges > 0);
+	maxpa = memranges[nmemranges - 1].mr_end;
+	if (maxpa > MAXPHYSMEM) {
+		cprintf("Using only the first %uM of %uM physical memory\n",
+			MAXPHYSMEM / (1024 * 1024), maxpa / (1024 * 1024));
+		maxpa = MAXPHYSMEM;
+	}
+	npage = maxpa / PGSIZE;
+}
+
+//
+// Allocate n bytes of physical memory aligned on an
+// align-byte boundary.  Align must be a power of two.
+// Return kernel virtual address.  Returned memory is uninitialized.
+//
+// If we're out of memory, boot_alloc should panic.
+// This function may ONLY be used during initialization,
+// before the page_free_list has been set up.
+//
+static void*
+boot_alloc(uint32_t n, uint32_t align)
+{
+	extern char end[];
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+	void *v;
+
+	// Initialize boot_freemem if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment -
+	// i.e., the first virtual address that the linker
+	// did _not_ assign to any kernel code or global variables.
+	// The boot loader put the initrd right after that, if there
+	// is one, so we start past it.
+	if (boot_freemem == 0) {
+		boot_freemem = end;
+		if (bi->bi_magic == BOOTINFO_MAGIC && (bi->bi_flags & BI_INITRD)
+		    && KERNBASE + bi->bi_initrd + bi->bi_initrdsz > (uintptr_t) end)
+			boot_freemem = (char *) (KERNBASE + bi->bi_initrd
+						 + bi->bi_initrdsz);
+	}
+
+	if (page_nfree)
+		panic("boot_alloc: called after page_init");
+
+	// Everything below npage is mapped at KERNBASE by entry_pgdir
+	// already, so early allocations aren't limited to the first 4MB.
+	v = ROUNDUP(boot_freemem, align);
+	if (PADDR(v) + n > npage * PGSIZE || PADDR(v) + n < PADDR(v))
+		panic("boot_alloc: out of memory");
+	boot_freemem = (char *) v + n;
+	return v;
+}
+
+// Set up a two-level page table:
+//    boot_pgdir is its linear (virtual) address of the root
+//    boot_cr3 is the physical adresss of the root
+//
+// All physical memory is mapped at KERNBASE with 4MB pages (PTE_PS),
+// as entry_pgdir already does, so kernel accesses take up as few TLB
+// entries as possible.  The mappings are global (PTE_G), so they can
+// survive address space switches.
+//
+// This function only sets up the kernel part of the address space
+// (ie. addresses >= UTOP).  The user part of the address space
+// will be setup later.
+void
+i386_vm_init(void)
+{
+	pde_t* pgdir;
+	size_t kernsize, n;
+	int i;
+
+	// Find out how much memory the machine has (npage).
+	i386_detect_memory();
+
+	//////////////////////////////////////////////////////////////////////
+	// create initial page directory.
+	pgdir = boot_alloc(PGSIZE, PGSIZE);
+	memset(pgdir, 0, PGSIZE);
+	boot_pgdir = pgdir;
+	boot_cr3 = PADDR(pgdir);
+
+	//////////////////////////////////////////////////////////////////////
+	// Recursively insert PD in itself as a page table, to form
+	// a virtual page table at virtual address VPT.
+	// (For now, you don't have understand the greater purpose of the
+	// following two lines.)
+
+	// Permissions: kernel RW, user NONE
+	pgdir[PDX(VPT)] = PADDR(pgdir)|PTE_W|PTE_P;
+
+	// same for UVPT
+	// Permissions: kernel R, user R
+	pgdir[PDX(UVPT)] = PADDR(pgdir)|PTE_U|PTE_P;
+
+	//////////////////////////////////////////////////////////////////////
+	// Make 'pages' point to an array of size 'npage' of 'struct Page'.
+	// The kernel uses this structure to keep track of physical pages;
+	// 'npage' equals the number of physical pages in memory.  User-level
+	// programs get read-only access to the array as well.
+	// You must allocate the array yourself.
+	n = npage * sizeof(struct Page);
+	pages = boot_alloc(n, PGSIZE);
+	memset(pages, 0, n);
+
+	//////////////////////////////////////////////////////////////////////
+	// Map 'pages' read-only by the user at linear address UPAGES
+	// Permissions:
+	//    - pages -- kernel RW, user NONE
+	//    - the read-only version mapped at UPAGES -- kernel R, user R
+	boot_map_segment(pgdir, UPAGES, ROUNDUP(n, PGSIZE), PADDR(pages), PTE_U);
+
+	//////////////////////////////////////////////////////////////////////
+	// Make 'envs' point to an array of size 'NENV' of 'struct Env',
+	// and map it read-only by the user at linear address UENVS.
+	// Permissions:
+	//    - envs itself -- kernel RW, user NONE
+	//    - the image of envs mapped at UENVS  -- kernel R, user R
+	n = NENV * sizeof(struct Env);
+	envs = boot_alloc(n, PGSIZE);
+	memset(envs, 0, n);
+	boot_map_segment(pgdir, UENVS, ROUNDUP(n, PGSIZE), PADDR(envs), PTE_U);
+
+	//////////////////////////////////////////////////////////////////////
+	// Map each CPU's kernel stack below KSTACKTOP: CPU i's stack is
+	// percpu_kstacks[i], at [KSTACKTOP_CPU(i) - KSTKSIZE,
+	// KSTACKTOP_CPU(i)), with an unmapped KSTKGAP below it as a guard.
+	// The boot CPU keeps running on bootstack until it first enters
+	// the kernel through its TSS.
+	//     Permissions: kernel RW, user NONE
+	for (i = 0; i < NCPU; i++)
+		boot_map_segment(pgdir, KSTACKTOP_CPU(i) - KSTKSIZE, KSTKSIZE,
+				 PADDR(percpu_kstacks[i]), PTE_W | PTE_G);
+
+	//////////////////////////////////////////////////////////////////////
+	// Make the page table for [MMIOBASE, MMIOLIM) now, so that
+	// mmio_map_region() never has to allocate.
+	boot_pgdir_walk(pgdir, MMIOBASE);
+
+	//////////////////////////////////////////////////////////////////////
+	// Map all of physical memory at KERNBASE, 4MB at a time.
+	//      Permissions: kernel RW, user NONE
+	kernsize = ROUNDUP(npage * PGSIZE, PTSIZE);
+	boot_map_segment(pgdir, KERNBASE, kernsize, 0,
+			 PTE_W | PTE_PS | PTE_G);
+
+	check_boot_pgdir();
+
+	vm_init_percpu();
+}
+
+// Switch the calling CPU to boot_pgdir.  The boot CPU calls this at
+// the end of i386_vm_init(), the others from mp_main().
+void
+vm_init_percpu(void)
+{
+	uint32_t edx;
+
+	// entry.S already turned on CR4_PSE, so switching is all it takes.
+	// The identity map of the low 4MB that entry.S needed is gone now.
+	lcr3(boot_cr3);
+
+	// Turn on global pages, if the CPU has them, so the kernel's
+	// TLB entries survive the CR3 load on every address space switch.
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (edx & CPUID_PGE)
+		lcr4(rcr4() | CR4_PGE);
+}
+
+// Load the GDT and this CPU's TSS.  Every CPU calls this once, after
+// mp_init() has numbered them.
+void
+seg_init_percpu(void)
+{
+	int id = cpunum();
+	struct Taskstate *ts = &cpus[id].cpu_ts;
+
+	// Load the GDT.
+	// Segments in the boot loader's GDT are the same, but that one
+	// lives in memory that we're about to reclaim.
+	asm volatile("lgdt gdt_pd");
+	// The kernel never uses GS or FS, so we leave those set to
+	// the user data segment.
+	asm volatile("movw %%ax,%%gs" :: "a" (GD_UD|3));
+	asm volatile("movw %%ax,%%fs" :: "a" (GD_UD|3));
+	// The kernel does use ES, DS, and SS.  We'll change between
+	// the kernel and user data segments as needed.
+	asm volatile("movw %%ax,%%es" :: "a" (GD_KD));
+	asm volatile("movw %%ax,%%ds" :: "a" (GD_KD));
+	asm volatile("movw %%ax,%%ss" :: "a" (GD_KD));
+	// Load the kernel text segment into CS.
+	asm volatile("ljmp %0,$1f\n 1:\n" :: "i" (GD_KT));
+	// For good measure, clear the local descriptor table (LDT),
+	// since we don't use it.
+	lldt(0);
+
+	// Setup a TSS so that we get the right stack
+	// when we trap to the kernel.
+	ts->ts_esp0 = KSTACKTOP_CPU(id);
+	ts->ts_ss0 = GD_KD;
+
+	// Initialize the TSS slot of the gdt.  Loading it marks it busy,
+	// so each CPU needs its own slot.
+	gdt[(GD_TSS0 >> 3) + id] = SEG16(STS_T32A, (uint32_t) ts,
+					 sizeof(struct Taskstate) - 1, 0);
+	gdt[(GD_TSS0 >> 3) + id].sd_s = 0;
+
+	// Load the TSS selector (like other segment selectors, the
+	// bottom three bits are special; we leave them 0)
+	ltr(GD_TSS0 + (id << 3));
+}
+
+//
+// Reserve size bytes in the MMIO region and map [pa,pa+size) at this
+// location.  Return the base of the reserved region.  size does *not*
+// have to be multiple of PGSIZE, nor does pa have to be page-aligned;
+// the returned pointer has pa's offset within its page.
+//
+// The mappings are uncached (PTE_PCD|PTE_PWT): device memory must not
+// be cached, and neither is there any point for firmware tables that
+// are read once.
+//
+void *
+mmio_map_region(physaddr_t pa, size_t size)
+{
+	uintptr_t va = mmio_next;
+	physaddr_t base = ROUNDDOWN(pa, PGSIZE);
+
+	size = ROUNDUP(pa + size, PGSIZE) - base;
+	if (size > MMIOLIM - mmio_next)
+		panic("mmio_map_region: out of MMIO space");
+	boot_map_segment(boot_pgdir, va, size, base,
+			 PTE_PCD | PTE_PWT | PTE_W | PTE_G);
+	mmio_next += size;
+	return (void *) (va + (pa - base));
+}
+
+// --------------------------------------------------------------
+// Tracking of physical pages.
+// The 'pages' array has one 'struct Page' entry per physical page.
+// Free pages are kept by a binary buddy allocator: a free block of
+// 2^o pages sits on page_free_list[o], and freeing a block merges it
+// with its buddy (the block it was split from) whenever that is free
+// too, so contiguous runs of up to 4MB stay available.  Single pages
+// mostly come and go through the per-CPU magazines instead.
+// --------------------------------------------------------------
+
+//
+// Initialize the page structures and the free lists.
+// After this point, ONLY use the functions below
+// to allocate and deallocate physical memory via the free lists,
+// and NEVER use boot_alloc()
+//
+void
+page_init(void)
+{
+	physaddr_t pa, end, kernend;
+	struct Page *pp;
+	int i;
+
+	spin_initlock(&page_lock);
+	for (i = 0; i <= PAGE_MAXORDER; i++)
+		LIST_INIT(&page_free_list[i]);
+	spin_initlock(&zero_lock);
+	LIST_INIT(&zero_pool);
+
+	// Everything starts out in use; then we free what the
+	// memory map says is RAM, except for
+	//  - page 0, which holds the real-mode IDT and the BIOS data
+	//    area (boot_aps() uses its warm reset vector),
+	//  - the Bootinfo page, which the monitor still reads,
+	//  - the I/O hole, the kernel image, and everything boot_alloc()
+	//    handed out: [IOPHYSMEM, boot_freemem).
+	// memranges already leaves out the initrd and MPENTRY_PADDR.
+	for (i = 0; i < npage; i++)
+		pages[i].pp_ref = 1;
+	kernend = PADDR(ROUNDUP(boot_freemem, PGSIZE));
+	for (i = 0; i < nmemranges; i++) {
+		end = MIN(memranges[i].mr_end, npage * PGSIZE);
+		for (pa = memranges[i].mr_start; pa < end; pa += PGSIZE) {
+			if (pa == 0 || pa == BOOTINFO_PADDR
+			    || (pa >= IOPHYSMEM && pa < kernend))
+				continue;
+			pp = pa2page(pa);
+			pp->pp_ref = 0;
+			page_free_order(pp, 0);
+		}
+	}
+	cprintf("page_init: %uK free\n", page_nfree * PGSIZE / 1024);
+
+	check_page_alloc();
+	check_page_mag();
+	check_zero_pool();
+}
+
+// Take a free block of 2^order pages off the free lists, splitting a
+// bigger one if need be.  Returns NULL if there is no free block that
+// large.  The caller holds page_lock.
+static struct Page *
+buddy_alloc(int order)
+{
+	struct Page *pp, *buddy;
+	int o;
+
+	// Find the smallest free block that will do
+	for (o = order; o <= PAGE_MAXORDER; o++)
+		if (!LIST_EMPTY(&page_free_list[o]))
+			break;
+	if (o > PAGE_MAXORDER)
+		return NULL;
+
+	pp = LIST_FIRST(&page_free_list[o]);
+	LIST_REMOVE(pp, pp_link);
+	pp->pp_flags &= ~PP_FREE;
+
+	// Split it, putting the upper halves back
+	while (o > order) {
+		o--;
+		buddy = pp + (1 << o);
+		buddy->pp_order = o;
+		buddy->pp_flags |= PP_FREE;
+		LIST_INSERT_HEAD(&page_free_list[o], buddy, pp_link);
+	}
+
+	pp->pp_order = order;
+	page_nfree -= 1 << order;
+	return pp;
+}
+
+// Put a block of 2^order pages back on the free lists, merging it with
+// its buddy for as long as that is free.  The caller holds page_lock.
+static void
+buddy_free(struct Page *pp, int order)
+{
+	struct Page *buddy;
+	ppn_t ppn = page2ppn(pp);
+
+	page_nfree += 1 << order;
+	while (order < PAGE_MAXORDER) {
+		buddy = &pages[ppn ^ (1 << order)];
+		if (buddy >= pages + npage || !(buddy->pp_flags & PP_FREE)
+		    || buddy->pp_order != order)
+			break;
+		LIST_REMOVE(buddy, pp_link);
+		buddy->pp_flags &= ~PP_FREE;
+		ppn &= ~(1 << order);
+		order++;
+	}
+
+	pp = &pages[ppn];
+	pp->pp_order = order;
+	pp->pp_flags |= PP_FREE;
+	LIST_INSERT_HEAD(&page_free_list[order], pp, pp_link);
+}
+
+static void
+page_free_check(struct Page *pp, int order)
+{
+	assert(order >= 0 && order <= PAGE_MAXORDER);
+	if (pp->pp_ref != 0 || (pp->pp_flags & (PP_FREE | PP_MAG))
+	    || (page2ppn(pp) & ((1 << order) - 1)))
+		panic("page_free: bad free of page %08x order %d",
+		      page2pa(pp), order);
+}
+
+//
+// Allocates a block of 2^order physically contiguous pages, aligned to
+// its size.  If (alloc_flags & ALLOC_ZERO), fills the block with '\0'
+// bytes.  Does NOT increment the reference count of the page - the
+// caller must do these if necessary (either explicitly or via
+// page_insert).
+//
+// Returns NULL if there is no free block that large.
+//
+struct Page *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct Page *pp;
+
+	assert(order >= 0 && order <= PAGE_MAXORDER);
+	spin_lock(&page_lock);
+	pp = buddy_alloc(order);
+	spin_unlock(&page_lock);
+
+	if (pp && (alloc_flags & ALLOC_ZERO))
+		memset(page2kva(pp), 0, PGSIZE << order);
+	return pp;
+}
+
+//
+// Return a block of 2^order pages, from page_alloc_order(), to the
+// free lists.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free_order(struct Page *pp, int order)
+{
+	page_free_check(pp, order);
+	spin_lock(&page_lock);
+	buddy_free(pp, order);
+	spin_unlock(&page_lock);
+}
+
+// Pages in a magazine are marked PP_MAG, not PP_FREE: to the buddy
+// allocator they are allocated, and mustn't be merged with their
+// buddies.  The mark lets page_free() catch a page freed twice.
+
+// Take a page from this CPU's magazine, refilling it if it's empty.
+static struct Page *
+mag_alloc(struct PageMagazine *pm)
+{
+	struct Page *pp;
+
+	if (pm->pm_count == 0) {
+		spin_lock(&page_lock);
+		while (pm->pm_count < PAGE_MAGBATCH
+		       && (pp = buddy_alloc(0)) != NULL) {
+			pp->pp_flags |= PP_MAG;
+			pm->pm_pages[pm->pm_count++] = pp;
+		}
+		spin_unlock(&page_lock);
+		pm->pm_refills++;
+		if (pm->pm_count == 0)
+			return NULL;
+	}
+
+	// Most recently freed first: it's the likeliest to be in cache
+	pp = pm->pm_pages[--pm->pm_count];
+	pp->pp_flags &= ~PP_MAG;
+	return pp;
+}
+
+// Send n pages from the magazine back to the free lists.
+static void
+mag_drain(struct PageMagazine *pm, int n)
+{
+	struct Page *pp;
+
+	spin_lock(&page_lock);
+	while (n-- > 0) {
+		pp = pm->pm_pages[--pm->pm_count];
+		pp->pp_flags &= ~PP_MAG;
+		buddy_free(pp, 0);
+	}
+	spin_unlock(&page_lock);
+}
+
+// Put a page in this CPU's magazine, draining half of it first if
+// it's full.
+static void
+mag_free(struct PageMagazine *pm, struct Page *pp)
+{
+	if (pm->pm_count == PAGE_MAGSIZE) {
+		mag_drain(pm, PAGE_MAGBATCH);
+		pm->pm_drains++;
+	}
+	pp->pp_flags |= PP_MAG;
+	pm->pm_pages[pm->pm_count++] = pp;
+}
+
+// Take a page from the zero pool, or return NULL if it is empty.
+static struct Page *
+zero_pool_get(void)
+{
+	struct Page *pp;
+
+	if (zero_pool_count == 0)
+		return NULL;
+	spin_lock(&zero_lock);
+	if ((pp = LIST_FIRST(&zero_pool)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		zero_pool_count--;
+	}
+	spin_unlock(&zero_lock);
+	return pp;
+}
+
+//
+// Allocates a single physical page, from this CPU's magazine if it has
+// one, without taking page_lock.  With ALLOC_ZERO, a page from the
+// zero pool comes first.  See page_alloc_order().
+//
+// Pages parked in other CPUs' magazines (at most PAGE_MAGSIZE per CPU)
+// don't count, so this can fail a little before memory is truly gone.
+//
+struct Page *
+page_alloc(int alloc_flags)
+{
+	struct PageMagazine *pm = &page_mags[cpunum()];
+	struct Page *pp;
+	uint64_t t0;
+
+	if ((alloc_flags & ALLOC_ZERO) && (pp = zero_pool_get()) != NULL) {
+		pm->pm_zerohit++;
+		return pp;
+	}
+
+	if (page_nomag)
+		pp = page_alloc_order(0, 0);
+	else
+		pp = mag_alloc(pm);
+	if (pp == NULL)
+		// Zeroed pages will do for anyone
+		return zero_pool_get();
+
+	if (alloc_flags & ALLOC_ZERO) {
+		t0 = read_tsc();
+		memset(page2kva(pp), 0, PGSIZE);
+		pm->pm_zerocycles += read_tsc() - t0;
+		pm->pm_zeromiss++;
+	}
+	return pp;
+}
+
+//
+// Zero one free page into the zero pool, unless the pool is full or
+// free memory is low.  CPUs call this while they wait for something
+// (like the console waiting for a key), so it only does one page,
+// a microsecond or so of work, at a time.
+//
+void
+page_zero_idle(void)
+{
+	struct Page *pp;
+	uint64_t t0;
+
+	if (zero_pool_count >= ZERO_POOL_MAX || page_nfree < ZERO_POOL_RESERVE)
+		return;
+	if ((pp = page_alloc(0)) == NULL)
+		return;
+
+	t0 = read_tsc();
+	memset(page2kva(pp), 0, PGSIZE);
+	t0 = read_tsc() - t0;
+
+	spin_lock(&zero_lock);
+	LIST_INSERT_HEAD(&zero_pool, pp, pp_link);
+	zero_pool_count++;
+	zero_nfilled++;
+	zero_fillcycles += t0;
+	spin_unlock(&zero_lock);
+}
+
+//
+// Report how the zero pool is doing: how many ALLOC_ZERO allocations
+// it served, and the zeroing cycles that took off their path.
+//
+void
+page_zero_info(void)
+{
+	struct PageMagazine *pm;
+	uint32_t hit = 0, miss = 0;
+	uint64_t misscycles = 0, perpage;
+
+	for (pm = page_mags; pm < page_mags + NCPU; pm++) {
+		hit += pm->pm_zerohit;
+		miss += pm->pm_zeromiss;
+		misscycles += pm->pm_zerocycles;
+	}
+
+	// What a zeroing costs when someone is waiting for it
+	if (miss)
+		perpage = misscycles / miss;
+	else if (zero_nfilled)
+		perpage = zero_fillcycles / zero_nfilled;
+	else
+		perpage = 0;
+
+	cprintf("zero pool: %d of %d pages\n", zero_pool_count, ZERO_POOL_MAX);
+	cprintf("zeroed while idle: %u pages, %llu cycles/page\n",
+		zero_nfilled, zero_nfilled ? zero_fillcycles / zero_nfilled : 0);
+	cprintf("ALLOC_ZERO hits: %u  misses: %u (%llu cycles/page)\n",
+		hit, miss, miss ? misscycles / miss : 0);
+	cprintf("cycles saved: %llu\n", (uint64_t) hit * perpage);
+}
+
+//
+// Return a page to this CPU's magazine, sending half of the magazine
+// back to the free lists first if it is full.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free(struct Page *pp)
+{
+	page_free_check(pp, 0);
+	if (page_nomag)
+		page_free_order(pp, 0);
+	else
+		mag_free(&page_mags[cpunum()], pp);
+}
+
+//
+// Decrement the reference count on a page,
+// freeing it if there are no more refs.
+//
+void
+page_decref(struct Page* pp)
+{
+	if (--pp->pp_ref != 0)
+		return;
+	if (pp->pp_order == 0)
+		page_free(pp);
+	else
+		page_free_order(pp, pp->pp_order);
+}
+
+// Given 'pgdir', a pointer to a page directory, pgdir_walk returns
+// a pointer to the page table entry (PTE) for linear address 'va'.
+// This requires walking the two-level page table structure.
+//
+// If the relevant page table doesn't exist in the page directory, then:
+//    - If create == 0, pgdir_walk returns NULL.
+//    - Otherwise, pgdir_walk tries to allocate a new page table
+//	with page_alloc.  If this fails, pgdir_walk returns NULL.
+//    - Otherwise, pgdir_walk returns a pointer into the new page table.
+//
+// Only for addresses below UTOP: above it, the kernel maps memory
+// with 4MB pages, which have no page table.
+//
+pte_t *
+pgdir_walk(pde_t *pgdir, const void *va, int create)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct Page *pp;
+
+	assert(!(*pde & PTE_PS));
+	if (!(*pde & PTE_P)) {
+		if (!create || (pp = page_alloc(ALLOC_ZERO)) == NULL)
+			return NULL;
+		pp->pp_ref++;
+		// Permissions are checked in the PTEs.
+		*pde = page2pa(pp) | PTE_U | PTE_W | PTE_P;
+	}
+	return (pte_t *) KADDR(PTE_ADDR(*pde)) + PTX(va);
+}
+
+//
+// Map the physical page 'pp' at virtual address 'va'.
+// The permissions (the low 12 bits) of the page table
+//  entry should be set to 'perm|PTE_P'.
+//
+// Details
+//   - If there is already a page mapped at 'va', it is page_remove()d.
+//   - If necessary, on demand, allocates a page table and inserts it into
+//     'pgdir'.
+//   - pp->pp_ref should be incremented if the insertion succeeds.
+//   - The TLB must be invalidated if a page was formerly present at 'va'.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if page table couldn't be allocated
+//
+int
+page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm)
+{
+	pte_t *pte;
+
+	if ((pte = pgdir_walk(pgdir, va, 1)) == NULL)
+		return -E_NO_MEM;
+	// Take the reference first, in case pp is already mapped here.
+	pp->pp_ref++;
+	if (*pte & PTE_P)
+		page_remove(pgdir, va);
+	*pte = page2pa(pp) | perm | PTE_P;
+	return 0;
+}
+
+//
+// Return the page mapped at virtual address 'va'.
+// If pte_store is not zero, then we store in it the address
+// of the pte for this page.
+//
+// Return 0 if there is no page mapped at va.
+//
+struct Page *
+page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
+{
+	pte_t *pte;
+
+	if ((pte = pgdir_walk(pgdir, va, 0)) == NULL || !(*pte & PTE_P))
+		return NULL;
+	if (pte_store)
+		*pte_store = pte;
+	return pa2page(PTE_ADDR(*pte));
+}
+
+//
+// Unmaps the physical page at virtual address 'va'.
+// If there is no physical page at that address, silently does nothing.
+//
+// Details:
+//   - The ref count on the physical page should decrement.
+//   - The physical page should be freed if the refcount reaches 0.
+//   - The pg table entry corresponding to 'va' should be set to 0.
+//     (if such a PTE exists)
+//   - The TLB must be invalidated if you remove an entry from
+//     the pg dir/pg table.
+//
+void
+page_remove(pde_t *pgdir, void *va)
+{
+	struct Page *pp;
+	pte_t *pte;
+
+	if ((pp = page_lookup(pgdir, va, &pte)) == NULL)
+		return;
+	*pte = 0;
+	tlb_invalidate(pgdir, va);
+	page_decref(pp);
+}
+
+//
+// Invalidate a TLB entry, but only if the page tables being
+// edited are the ones currently in use by the processor.
+// There is no TLB shootdown: an environment's page tables may only be
+// edited while it isn't current on any other CPU, so no other TLB can
+// hold its entries.
+//
+void
+tlb_invalidate(pde_t *pgdir, void *va)
+{
+	struct CpuInfo *c, *self = thiscpu;
+
+	for (c = cpus; c < cpus + ncpu; c++)
+		assert(c == self || !c->cpu_env
+		       || c->cpu_env->env_pgdir != pgdir);
+	if (rcr3() == PADDR(pgdir))
+		invlpg(va);
+}
+
+// --------------------------------------------------------------
+// Address spaces.
+// An address space is a page directory whose part above UTOP is the
+// kernel's, shared with boot_pgdir, and whose part below UTOP is its
+// own.  Duplicating one shares its pages copy-on-write: both sides
+// map every writable page read-only with PTE_COW, and the first write
+// from either side takes a page fault that gives the writer a copy.
+//
+// The pp_ref updates aren't atomic, so a given set of shared pages
+// must only be duplicated and faulted on by one CPU at a time.
+// --------------------------------------------------------------
+
+// Counts of the two ways pgdir_cow_fault() resolves a fault
+static uint32_t cow_ncopy;	// had to copy the page
+static uint32_t cow_nreuse;	// the page was no longer shared
+
+//
+// Allocate a page directory for a new address space, with the
+// kernel's mappings and nothing below UTOP, and store it in
+// *pgdir_store.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if there was no page for the directory
+//
+int
+pgdir_alloc(pde_t **pgdir_store)
+{
+	struct Page *pp;
+	pde_t *pgdir;
+
+	if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	pgdir = page2kva(pp);
+
+	// The kernel's page tables above UTOP are all made at boot
+	// (i386_vm_init() pre-creates the MMIO one), so sharing the
+	// PDEs shares every later change to them too.
+	memmove(&pgdir[PDX(UTOP)], &boot_pgdir[PDX(UTOP)],
+		(NPDENTRIES - PDX(UTOP)) * sizeof(pde_t));
+
+	// VPT and UVPT map the env's own page table, with
+	// different permissions.
+	pgdir[PDX(VPT)] = PADDR(pgdir) | PTE_W | PTE_P;
+	pgdir[PDX(UVPT)] = PADDR(pgdir) | PTE_U | PTE_P;
+
+	*pgdir_store = pgdir;
+	return 0;
+}
+
+//
+// Free an address space from pgdir_alloc(): drop its references to
+// every page and page table below UTOP, then the directory itself.
+// If it is the current address space, switches to boot_pgdir first.
+//
+void
+pgdir_free(pde_t *pgdir)
+{
+	pte_t *pt;
+	uint32_t pdeno, pteno;
+
+	if (rcr3() == PADDR(pgdir))
+		lcr3(boot_cr3);
+
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(pgdir[pdeno] & PTE_P))
+			continue;
+		pt = KADDR(PTE_ADDR(pgdir[pdeno]));
+		for (pteno = 0; pteno < NPTENTRIES; pteno++)
+			if (pt[pteno] & PTE_P)
+				page_decref(pa2page(PTE_ADDR(pt[pteno])));
+		pgdir[pdeno] = 0;
+		page_decref(pa2page(PADDR(pt)));
+	}
+	page_decref(pa2page(PADDR(pgdir)));
+}
+
+//
+// Make 'dst', a fresh address space from pgdir_alloc(), a
+// copy-on-write duplicate of 'src' below UTOP.  Writable pages (and
+// pages that are already copy-on-write) end up read-only with PTE_COW
+// in both; read-only pages are simply shared.  Nothing is copied but
+// the page tables.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if there was no memory for a page table.  'dst' then
+//	holds part of 'src' and should be freed with pgdir_free().
+//
+int
+pgdir_dup_cow(pde_t *dst, pde_t *src)
+{
+	struct Page *pp;
+	pte_t *spt, *dpt, pte;
+	uint32_t pdeno, pteno;
+	int r = 0;
+
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(src[pdeno] & PTE_P))
+			continue;
+		if ((pp = page_alloc(0)) == NULL) {
+			r = -E_NO_MEM;
+			break;
+		}
+		pp->pp_ref++;
+		dst[pdeno] = page2pa(pp) | PTE_U | PTE_W | PTE_P;
+		spt = KADDR(PTE_ADDR(src[pdeno]));
+		dpt = page2kva(pp);
+		for (pteno = 0; pteno < NPTENTRIES; pteno++) {
+			pte = spt[pteno];
+			if (pte & PTE_P) {
+				if (pte & (PTE_W | PTE_COW)) {
+					pte = (pte & ~PTE_W) | PTE_COW;
+					spt[pteno] = pte;
+				}
+				pa2page(PTE_ADDR(pte))->pp_ref++;
+			}
+			dpt[pteno] = pte;
+		}
+	}
+
+	// One flush for all the PTEs made read-only in src, rather than
+	// an invlpg for each.
+	if (rcr3() == PADDR(src))
+		tlbflush();
+	return r;
+}
+
+//
+// Make 'dst', a fresh address space from pgdir_alloc(), a duplicate
+// of 'src' below UTOP by copying every page up front.  This is the
+// eager alternative to pgdir_dup_cow().
+//
+// RETURNS: as for pgdir_dup_cow().
+//
+int
+pgdir_dup_copy(pde_t *dst, pde_t *src)
+{
+	struct Page *pp;
+	pte_t *spt, *dpt;
+	uint32_t pdeno, pteno;
+	int perm;
+
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(src[pdeno] & PTE_P))
+			continue;
+		if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+			return -E_NO_MEM;
+		pp->pp_ref++;
+		dst[pdeno] = page2pa(pp) | PTE_U | PTE_W | PTE_P;
+		spt = KADDR(PTE_ADDR(src[pdeno]));
+		dpt = page2kva(pp);
+		for (pteno = 0; pteno < NPTENTRIES; pteno++) {
+			if (!(spt[pteno] & PTE_P))
+				continue;
+			if ((pp = page_alloc(0)) == NULL)
+				return -E_NO_MEM;
+			pp->pp_ref++;
+			memmove(page2kva(pp), KADDR(PTE_ADDR(spt[pteno])),
+				PGSIZE);
+			perm = spt[pteno] & PTE_ALLOWED;
+			if (perm & PTE_COW)
+				perm = (perm & ~PTE_COW) | PTE_W;
+			dpt[pteno] = page2pa(pp) | perm;
+		}
+	}
+	return 0;
+}
+
+//
+// Handle a write fault at 'va' in the address space 'pgdir'.  If the
+// page there is copy-on-write, make it writable: when nobody else
+// maps it any more (pp_ref == 1) just by restoring PTE_W, otherwise
+// by mapping a private copy in its place.
+//
+// RETURNS:
+//   0 if the write can be retried
+//   -E_FAULT, if 'va' isn't a copy-on-write page
+//   -E_NO_MEM, if there was no page for the copy
+//
+int
+pgdir_cow_fault(pde_t *pgdir, uintptr_t va)
+{
+	struct Page *pp, *copy;
+	pte_t *pte;
+
+	if (va >= UTOP || (pte = pgdir_walk(pgdir, (void *) va, 0)) == NULL
+	    || (*pte & (PTE_COW | PTE_P)) != (PTE_COW | PTE_P))
+		return -E_FAULT;
+
+	pp = pa2page(PTE_ADDR(*pte));
+	if (pp->pp_ref == 1) {
+		*pte = (*pte & ~PTE_COW) | PTE_W;
+		cow_nreuse++;
+	} else {
+		if ((copy = page_alloc(0)) == NULL)
+			return -E_NO_MEM;
+		copy->pp_ref++;
+		memmove(page2kva(copy), page2kva(pp), PGSIZE);
+		*pte = page2pa(copy) | (*pte & PTE_ALLOWED & ~PTE_COW) | PTE_W;
+		page_decref(pp);
+		cow_ncopy++;
+	}
+	tlb_invalidate(pgdir, (void *) va);
+	return 0;
+}
+
+// --------------------------------------------------------------
+// Checking user memory.
+// --------------------------------------------------------------
+
+uintptr_t user_mem_check_addr;	// first bad address user_mem_check() found
+
+// Is the page at 'va' in env's address space, whose PTE is 'pte',
+// good for an access with permissions 'perm'?  Besides the PTE
+// allowing it outright, a write to a copy-on-write page will do, and
+// so will a page that a demand-zero region supplies: the kernel's own
+// access takes the fault that makes it so.
+static bool
+user_page_ok(struct Env *env, uintptr_t va, pte_t pte, int perm)
+{
+	if ((pte & perm) == perm)
+		return 1;
+	if ((pte & (PTE_P | PTE_COW)) == (PTE_P | PTE_COW))
+		return ((pte | PTE_W) & perm) == perm;
+	if (!(pte & PTE_P))
+		return (env_region_perm(env, va) & perm) == perm;
+	return 0;
+}
+
+//
+// Check that environment 'env' is allowed to access the range of memory
+// [va, va+len) with permissions 'perm | PTE_U | PTE_P'.
+// If it can, then the function simply returns 0.
+// If there is an error, set the 'user_mem_check_addr' variable to the first
+// erroneous virtual address, and return -E_FAULT.
+//
+// When env's address space is the current one, this reads the PTEs
+// straight out of vpd[] and vpt[], with no walking at all.  A 4MB page
+// settles its whole PTSIZE at once, and so does a missing page table,
+// with one lookup of the demand-zero region that covers it.  Each
+// other page table is checked in a single pass, by ANDing all its
+// PTEs together; only a page table that fails that is gone through
+// page by page.  For any other address
+// space, this falls back to user_mem_check_walk().
+//
+int
+user_mem_check(struct Env *env, const void *va, size_t len, int perm)
+{
+	uintptr_t start = (uintptr_t) va, end = start + len;
+	uintptr_t re;
+	uint32_t pn, lastpn, lim, i;
+	pde_t pde;
+	pte_t acc;
+
+	if (len == 0)
+		return 0;
+	perm |= PTE_U | PTE_P;
+	if (end < start || end > ULIM) {
+		user_mem_check_addr = MAX(start, ULIM);
+		return -E_FAULT;
+	}
+	if (rcr3() != env->env_cr3)
+		return user_mem_check_walk(env, va, len, perm);
+
+	lastpn = VPN(end - 1);
+	for (pn = VPN(start); pn <= lastpn; pn = lim) {
+		lim = MIN(lastpn + 1, ROUNDDOWN(pn, NPTENTRIES) + NPTENTRIES);
+		pde = vpd[pn / NPTENTRIES];
+
+		if (!(pde & PTE_P)) {
+			// No page table: only demand-zero pages are good.
+			// One region usually covers the whole slice; if
+			// not, take it a region at a time.
+			for (; pn < lim; pn = MIN(lim, VPN(re)))
+				if ((re = env_region_end(env, pn << PGSHIFT,
+							 perm)) == pn << PGSHIFT)
+					goto bad;
+			continue;
+		}
+		if ((pde & perm) != perm)
+			goto bad;
+		if (pde & PTE_PS)
+			continue;
+
+		acc = perm;
+		for (i = pn; i < lim; i++)
+			acc &= vpt[i];
+		if (acc == perm)
+			continue;
+		for (; pn < lim; pn++)
+			if (!user_page_ok(env, pn << PGSHIFT, vpt[pn], perm))
+				goto bad;
+	}
+	return 0;
+
+bad:
+	user_mem_check_addr = MAX(start, pn << PGSHIFT);
+	return -E_FAULT;
+}
+
+//
+// user_mem_check() the slow way: look up each page of the range in
+// env's page directory with pgdir_walk().  Works for any address
+// space, current or not.
+//
+int
+user_mem_check_walk(struct Env *env, const void *va, size_t len, int perm)
+{
+	uintptr_t start = (uintptr_t) va, end = start + len, a;
+	pde_t pde;
+	pte_t pte;
+
+	if (len == 0)
+		return 0;
+	perm |= PTE_U | PTE_P;
+	if (end < start || end > ULIM) {
+		user_mem_check_addr = MAX(start, ULIM);
+		return -E_FAULT;
+	}
+
+	for (a = ROUNDDOWN(start, PGSIZE); a < end; a += PGSIZE) {
+		pde = env->env_pgdir[PDX(a)];
+		pte = 0;
+		if (pde & PTE_P) {
+			if ((pde & perm) != perm)
+				goto bad;
+			if (pde & PTE_PS)
+				continue;
+			pte = *pgdir_walk(env->env_pgdir, (void *) a, 0);
+		}
+		if (!user_page_ok(env, a, pte, perm))
+			goto bad;
+	}
+	return 0;
+
+bad:
+	user_mem_check_addr = MAX(start, a);
+	return -E_FAULT;
+}
+
+// Copy len bytes from src to dst, either of which may be a user
+// address, a word at a time.  Both rep instructions are in the fixup
+// table, so a fault that the page fault handler can't resolve makes
+// this return -E_FAULT, with part of the data copied, rather than
+// panic.
+static int
+copy_user(void *dst, const void *src, size_t len)
+{
+	size_t nword = len / 4;
+	int r;
+
+	asm volatile("	cld\n"
+		     "1:	rep movsl\n"
+		     "	movl %[rem], %%ecx\n"
+		     "2:	rep movsb\n"
+		     "	xorl %[r], %[r]\n"
+		     "	jmp 4f\n"
+		     "3:	movl %[efault], %[r]\n"
+		     "4:\n"
+		     "	.pushsection .fixup, \"a\"\n"
+		     "	.long 1b, 3b\n"
+		     "	.long 2b, 3b\n"
+		     "	.popsection\n"
+		     : [r] "=&a" (r), "+D" (dst), "+S" (src), "+c" (nword)
+		     : [rem] "r" (len & 3), [efault] "i" (-E_FAULT)
+		     : "memory", "cc");
+	return r;
+}
+
+// Is [va, va+len) entirely below ULIM?
+static bool
+user_range(uintptr_t va, size_t len)
+{
+	return va + len >= va && va + len <= ULIM;
+}
+
+//
+// Copy len bytes from user address usrc in the current address space
+// to kernel address dst.  There is no user_mem_check() up front:
+// the copy just goes ahead, with copy-on-write and demand-zero faults
+// resolved as usual, and any other fault on usrc ending it.
+//
+// RETURNS:
+//   0 on success
+//   -E_FAULT, if usrc isn't all user memory the current environment
+//	can read.  Part of dst may have been written.
+//
+int
+copyin(void *dst, const void *usrc, size_t len)
+{
+	if (!user_range((uintptr_t) usrc, len))
+		return -E_FAULT;
+	return copy_user(dst, usrc, len);
+}
+
+//
+// Copy len bytes from kernel address src to user address udst in the
+// current address space.  See copyin().
+//
+// RETURNS:
+//   0 on success
+//   -E_FAULT, if udst isn't all user memory the current environment
+//	can write.  Part of it may have been written.
+//
+int
+copyout(void *udst, const void *src, size_t len)
+{
+	if (!user_range((uintptr_t) udst, len))
+		return -E_FAULT;
+	return copy_user(udst, src, len);
+}
+
+// Return a pointer to the page table entry for 'la' in 'pgdir',
+// making a page table with boot_alloc if there is none.  A new page
+// table's PDE allows everything; its PTEs decide what user mode can
+// do.  A 4MB page covering 'la' is split into a page table mapping
+// the same memory with the same permissions.
+static pte_t *
+boot_pgdir_walk(pde_t *pgdir, uintptr_t la)
+{
+	pde_t *pde = &pgdir[PDX(la)];
+	pte_t *pgtab;
+	int i;
+
+	if (!(*pde & PTE_P)) {
+		pgtab = boot_alloc(PGSIZE, PGSIZE);
+		memset(pgtab, 0, PGSIZE);
+		*pde = PADDR(pgtab) | PTE_U | PTE_W | PTE_P;
+	} else if (*pde & PTE_PS) {
+		pgtab = boot_alloc(PGSIZE, PGSIZE);
+		for (i = 0; i < NPTENTRIES; i++)
+			pgtab[i] = (PTE_ADDR(*pde) + i * PGSIZE)
+				| (*pde & 0xFFF & ~PTE_PS);
+		*pde = PADDR(pgtab) | (*pde & (PTE_U | PTE_W | PTE_P));
+	}
+	pgtab = (pte_t *) (KERNBASE + PTE_ADDR(*pde));
+	return &pgtab[PTX(la)];
+}
+
+//
+// Map [la, la+size) of linear address space to physical [pa, pa+size)
+// in the page table rooted at pgdir.  Size is a multiple of PGSIZE.
+// Use permission bits perm|PTE_P for the entries.  With PTE_PS in
+// perm, la, pa and size must be multiples of PTSIZE, and the range is
+// mapped with 4MB pages.
+//
+// This function may ONLY be used during initialization,
+// to set up the static mappings above UTOP.  It may be used again
+// later to change them, after which the caller has to flush the
+// stale TLB entries.
+//
+void
+boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int perm)
+{
+	size_t off;
+
+	if (perm & PTE_PS) {
+		assert(la % PTSIZE == 0 && pa % PTSIZE == 0 && size % PTSIZE == 0);
+		for (off = 0; off < size; off += PTSIZE)
+			pgdir[PDX(la + off)] = (pa + off) | perm | PTE_P;
+		return;
+	}
+
+	assert(la % PGSIZE == 0 && pa % PGSIZE == 0 && size % PGSIZE == 0);
+	for (off = 0; off < size; off += PGSIZE)
+		*boot_pgdir_walk(pgdir, la + off) = (pa + off) | perm | PTE_P;
+}
+
+//
+// Checks that the kernel part of virtual address space
+// has been setup roughly correctly(by i386_vm_init()).
+//
+// This function doesn't test every corner case,
+// in fact it doesn't test the permission bits at all,
+// but it is a pretty good sanity check.
+//
+static void
+check_boot_pgdir(void)
+{
+	uint32_t i, n;
+	pde_t *pgdir;
+
+	pgdir = boot_pgdir;
+
+	// check phys mem
+	for (i = 0; i < npage * PGSIZE; i += PGSIZE)
+		assert(check_va2pa(pgdir, KERNBASE + i) == i);
+
+	// which takes just one global 4MB page per PTSIZE
+	for (i = 0; i < npage * PGSIZE; i += PTSIZE)
+		assert((pgdir[PDX(KERNBASE + i)] & (PTE_PS | PTE_G))
+		       == (PTE_PS | PTE_G));
+
+	// check pages array
+	n = ROUNDUP(npage*sizeof(struct Page), PGSIZE);
+	for (i = 0; i < n; i += PGSIZE) {
+		assert(check_va2pa(pgdir, UPAGES + i) == PADDR(pages) + i);
+		assert(check_va_perm(pgdir, UPAGES + i) == (PTE_U | PTE_P));
+	}
+
+	// check envs array
+	n = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
+	for (i = 0; i < n; i += PGSIZE) {
+		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
+		assert(check_va_perm(pgdir, UENVS + i) == (PTE_U | PTE_P));
+	}
+
+	// check the user's read-only view of the page tables
+	assert((pgdir[PDX(UVPT)] & (PTE_U | PTE_W | PTE_P)) == (PTE_U | PTE_P));
+
+	// check kernel stacks, and the guard gaps between them
+	for (n = 0; n < NCPU; n++) {
+		uint32_t base = KSTACKTOP_CPU(n);
+		for (i = 0; i < KSTKSIZE; i += PGSIZE) {
+			assert(check_va2pa(pgdir, base - KSTKSIZE + i)
+			       == PADDR(percpu_kstacks[n]) + i);
+			assert(check_va_perm(pgdir, base - KSTKSIZE + i)
+			       == (PTE_W | PTE_P));
+		}
+		for (i = 0; i < KSTKGAP; i += PGSIZE)
+			assert(check_va2pa(pgdir, base - KSTKSIZE - KSTKGAP + i)
+			       == ~0);
+	}
+
+	// check for zero/non-zero in PDEs
+	for (i = 0; i < NPDENTRIES; i++) {
+		switch (i) {
+		case PDX(VPT):
+		case PDX(UVPT):
+		case PDX(KSTACKTOP-1):
+		case PDX(MMIOBASE):
+		case PDX(UPAGES):
+		case PDX(UENVS):
+			assert(pgdir[i]);
+			break;
+		default:
+			if (i >= PDX(KERNBASE) && i < PDX(KERNBASE + npage * PGSIZE - 1) + 1)
+				assert(pgdir[i]);
+			else
+				assert(pgdir[i] == 0);
+			break;
+		}
+	}
+	cprintf("check_boot_pgdir() succeeded!\n");
+}
+
+// This function returns the physical address of the page containing 'va',
+// defined by the page directory 'pgdir'.  The hardware normally performs
+// this functionality for us!  We define our own version to help check
+// the check_boot_pgdir() function; it shouldn't be used elsewhere.
+
+static physaddr_t
+check_va2pa(pde_t *pgdir, uintptr_t va)
+{
+	pte_t *p;
+
+	pgdir = &pgdir[PDX(va)];
+	if (!(*pgdir & PTE_P))
+		return ~0;
+	if (*pgdir & PTE_PS)
+		return PTE_ADDR(*pgdir) + (va & (PTSIZE - 1) & ~(PGSIZE - 1));
+	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
+	if (!(p[PTX(va)] & PTE_P))
+		return ~0;
+	return PTE_ADDR(p[PTX(va)]);
+}
+
+// The permissions that 'va' gets from both levels of 'pgdir', out of
+// PTE_U, PTE_W and PTE_P, or 0 if it isn't mapped.  Like check_va2pa,
+// for the checks only.
+static int
+check_va_perm(pde_t *pgdir, uintptr_t va)
+{
+	pde_t pde = pgdir[PDX(va)];
+	pte_t *p;
+
+	if (!(pde & PTE_P))
+		return 0;
+	if (pde & PTE_PS)
+		return pde & (PTE_U | PTE_W | PTE_P);
+	p = (pte_t*) KADDR(PTE_ADDR(pde));
+	if (!(p[PTX(va)] & PTE_P))
+		return 0;
+	return pde & p[PTX(va)] & (PTE_U | PTE_W | PTE_P);
+}
+
+// Cycles per switch to a new CR3 followed by 'ntouch' reads of the
+// kernel addresses in 'touch', with the current CR4_PGE setting.
+static uint64_t
+cr3_switch_cycles(int niter, volatile uint32_t **touch, int ntouch)
+{
+	uint64_t t0;
+	uint32_t cr3[2] = { boot_cr3, PADDR(bench_pgdir) };
+	int i, j;
+
+	t0 = read_tsc();
+	for (i = 0; i < niter; i++) {
+		lcr3(cr3[i & 1]);
+		for (j = 0; j < ntouch; j++)
+			(void) *touch[j];
+	}
+	return (read_tsc() - t0) / niter;
+}
+
+#define NTOUCH	24
+
+// Measure what an address space switch costs the kernel, with and
+// without global kernel mappings.  We flip between boot_pgdir and a
+// copy of it, the way a context switch between two environments
+// would, and after each switch touch what the kernel typically does:
+// its text, data, stack, and a spread of the direct map.  Without
+// CR4_PGE each of those is a TLB miss after every CR3 load.
+void
+pmap_cr3_bench(int niter)
+{
+	extern char etext[], edata[];
+	volatile uint32_t *touch[NTOUCH];
+	uint64_t base, global, nonglobal;
+	uint32_t cr4, edx, pa;
+	int ntouch = 0;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_PGE)) {
+		cprintf("This CPU has no global pages\n");
+		return;
+	}
+
+	memmove(bench_pgdir, boot_pgdir, PGSIZE);
+	bench_pgdir[PDX(VPT)] = PADDR(bench_pgdir) | PTE_W | PTE_P;
+	bench_pgdir[PDX(UVPT)] = PADDR(bench_pgdir) | PTE_U | PTE_P;
+
+	touch[ntouch++] = (uint32_t *) pmap_cr3_bench;
+	touch[ntouch++] = (uint32_t *) ROUNDDOWN(etext - 4, 4);
+	touch[ntouch++] = (uint32_t *) &npage;
+	touch[ntouch++] = (uint32_t *) ROUNDDOWN(edata - 4, 4);
+	touch[ntouch++] = (uint32_t *) read_esp();
+	touch[ntouch++] = (uint32_t *) (KSTACKTOP - 4);
+	for (pa = 0; pa < npage * PGSIZE && ntouch < NTOUCH; pa += PTSIZE)
+		touch[ntouch++] = (uint32_t *) (KERNBASE + pa);
+
+	cr4 = rcr4();
+	base = cr3_switch_cycles(niter, touch, 0);
+	global = cr3_switch_cycles(niter, touch, ntouch);
+	lcr4(cr4 & ~CR4_PGE);		// also flushes the global entries
+	nonglobal = cr3_switch_cycles(niter, touch, ntouch);
+	lcr4(cr4);
+	lcr3(boot_cr3);
+
+	cprintf("CR3 switch alone:               %llu cycles\n", base);
+	cprintf("  + %d kernel accesses, global:  %llu cycles\n", ntouch, global);
+	cprintf("  + %d kernel accesses, private: %llu cycles\n", ntouch, nonglobal);
+}
+
+// A small linear congruential generator, good enough to shuffle tests
+static uint32_t
+check_rand(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+#define CHECK_NBLOCK	256
+#define CHECK_NSTEP	8192
+
+//
+// Check the buddy allocator: a random mix of allocations of every
+// order and frees in random order.  Every block must be aligned, lie
+// in memory nobody else owns, and keep its contents until freed; and
+// once everything is freed, the free lists must be back to exactly
+// the blocks they started with.
+//
+static void
+check_page_alloc(void)
+{
+	static struct Page *blk[CHECK_NBLOCK];
+	static uint8_t blkorder[CHECK_NBLOCK];
+	size_t nfree0 = page_nfree, nblock0[PAGE_MAXORDER + 1];
+	uint32_t seed = 1, *p, tag;
+	struct Page *pp;
+	int i, j, o, slot, nalloc = 0, nfail = 0;
+
+	for (o = 0; o <= PAGE_MAXORDER; o++) {
+		nblock0[o] = 0;
+		LIST_FOREACH(pp, &page_free_list[o], pp_link) {
+			assert(pp->pp_flags & PP_FREE);
+			assert(pp->pp_order == o);
+			assert((page2ppn(pp) & ((1 << o) - 1)) == 0);
+			nblock0[o]++;
+		}
+	}
+
+	for (i = 0; i < CHECK_NSTEP; i++) {
+		j = check_rand(&seed) % CHECK_NBLOCK;
+		if (blk[j]) {
+			// check the tags and free it
+			pp = blk[j];
+			o = blkorder[j];
+			tag = page2pa(pp) ^ 0x5a5a5a5a;
+			p = page2kva(pp);
+			assert(p[0] == tag);
+			assert(p[(PGSIZE << o) / 4 - 1] == tag);
+			page_free_order(pp, o);
+			blk[j] = NULL;
+			continue;
+		}
+
+		// mostly small blocks, like real use
+		slot = j;
+		o = check_rand(&seed) % (PAGE_MAXORDER + 1);
+		if (check_rand(&seed) % 4)
+			o = o % 3;
+		if ((pp = page_alloc_order(o, 0)) == NULL) {
+			nfail++;
+			continue;
+		}
+		assert(!(pp->pp_flags & PP_FREE));
+		assert(pp->pp_order == o);
+		assert((page2ppn(pp) & ((1 << o) - 1)) == 0);
+		// no other live block may overlap this one
+		for (j = 0; j < CHECK_NBLOCK; j++)
+			if (blk[j])
+				assert(page2ppn(pp) + (1 << o) <= page2ppn(blk[j])
+				       || page2ppn(blk[j]) + (1 << blkorder[j])
+					  <= page2ppn(pp));
+		blk[slot] = pp;
+		blkorder[slot] = o;
+		tag = page2pa(pp) ^ 0x5a5a5a5a;
+		p = page2kva(pp);
+		p[0] = p[(PGSIZE << o) / 4 - 1] = tag;
+		nalloc++;
+	}
+
+	// ALLOC_ZERO zeroes the whole block
+	pp = page_alloc_order(2, ALLOC_ZERO);
+	assert(pp);
+	p = page2kva(pp);
+	for (i = 0; i < (PGSIZE << 2) / 4; i++)
+		assert(p[i] == 0);
+	page_free_order(pp, 2);
+
+	for (j = 0; j < CHECK_NBLOCK; j++)
+		if (blk[j]) {
+			page_free_order(blk[j], blkorder[j]);
+			blk[j] = NULL;
+		}
+
+	// everything coalesced back
+	assert(page_nfree == nfree0);
+	for (o = 0; o <= PAGE_MAXORDER; o++) {
+		i = 0;
+		LIST_FOREACH(pp, &page_free_list[o], pp_link)
+			i++;
+		assert(i == nblock0[o]);
+	}
+
+	cprintf("check_page_alloc() succeeded! (%d allocations, %d failed)\n",
+		nalloc, nfail);
+}
+
+#define CHECK_MAG_NPAGE	(PAGE_MAGSIZE + PAGE_MAGBATCH + 1)
+
+//
+// Check the page magazines.  Pages come out of one CPU's magazine,
+// which has to refill from the free lists several times, and go back
+// into another CPU's, which overflows and drains.  A page in a
+// magazine is marked PP_MAG, so that a second free of it panics, and
+// no page is lost along the way.  Runs before the other CPUs start,
+// on the magazines of two CPUs that haven't used them yet.
+//
+static void
+check_page_mag(void)
+{
+	static struct Page *blk[CHECK_MAG_NPAGE];
+	struct PageMagazine *a = &page_mags[NCPU - 1], *b = &page_mags[NCPU - 2];
+	size_t nfree0 = page_nfree;
+	uint32_t refills0 = a->pm_refills, drains0 = b->pm_drains;
+	int i;
+
+	assert(a->pm_count == 0 && b->pm_count == 0);
+
+	// The first allocation refills half a magazine
+	assert((blk[0] = mag_alloc(a)) != NULL);
+	assert(a->pm_refills == refills0 + 1);
+	assert(a->pm_count == PAGE_MAGBATCH - 1);
+	assert(page_nfree == nfree0 - PAGE_MAGBATCH);
+	for (i = 0; i < a->pm_count; i++)
+		assert((a->pm_pages[i]->pp_flags & (PP_MAG | PP_FREE)) == PP_MAG);
+
+	// and more refill it again
+	for (i = 1; i < CHECK_MAG_NPAGE; i++)
+		assert((blk[i] = mag_alloc(a)) != NULL);
+	assert(a->pm_refills - refills0
+	       == ROUNDUP(CHECK_MAG_NPAGE, PAGE_MAGBATCH) / PAGE_MAGBATCH);
+	for (i = 0; i < CHECK_MAG_NPAGE; i++)
+		assert(!(blk[i]->pp_flags & (PP_MAG | PP_FREE)));
+
+	// Freed on the other CPU: its magazine fills up and drains
+	for (i = 0; i < CHECK_MAG_NPAGE; i++) {
+		page_free_check(blk[i], 0);
+		mag_free(b, blk[i]);
+		assert(blk[i]->pp_flags & PP_MAG);
+		assert(b->pm_count <= PAGE_MAGSIZE);
+	}
+	assert(b->pm_drains > drains0);
+	assert(page_nfree + a->pm_count + b->pm_count == nfree0);
+
+	// Everything goes back
+	mag_drain(a, a->pm_count);
+	mag_drain(b, b->pm_count);
+	assert(page_nfree == nfree0);
+	for (i = 0; i < CHECK_MAG_NPAGE; i++)
+		assert(!(blk[i]->pp_flags & PP_MAG));
+	a->pm_refills = refills0;
+	b->pm_drains = drains0;
+
+	cprintf("check_page_mag() succeeded!\n");
+}
+
+#define BENCH_NBLOCK	64
+
+// Time page_alloc_order() and page_free_order() at each order, in
+// batches of BENCH_NBLOCK allocations followed by as many frees, so
+// the splitting and merging both get exercised.
+void
+page_alloc_bench(int niter)
+{
+	struct Page *blk[BENCH_NBLOCK];
+	uint64_t t0, talloc, tfree;
+	int i, j, n, o;
+
+	cprintf("%-6s %12s %12s %14s\n", "order", "alloc cyc", "free cyc",
+		"allocs/sec");
+	for (o = 0; o <= PAGE_MAXORDER; o++) {
+		talloc = tfree = 0;
+		n = 0;
+		for (i = 0; i < niter; i++) {
+			t0 = read_tsc();
+			for (j = 0; j < BENCH_NBLOCK; j++)
+				if ((blk[j] = page_alloc_order(o, 0)) == NULL)
+					break;
+			talloc += read_tsc() - t0;
+			n += j;
+			t0 = read_tsc();
+			while (--j >= 0)
+				page_free_order(blk[j], o);
+			tfree += read_tsc() - t0;
+		}
+		if (n == 0) {
+			cprintf("%-6d %12s %12s %14s\n", o, "-", "-", "-");
+			continue;
+		}
+		cprintf("%-6d %12llu %12llu %14llu\n", o, talloc / n,
+			tfree / n, tsc_freq() * n / (talloc ? talloc : 1));
+	}
+}
+
+// A little more than one magazine refill's worth, so the magazines
+// still go back to the free lists now and then.
+#define MAGBENCH_NBLOCK	(PAGE_MAGBATCH + PAGE_MAGBATCH / 2)
+
+struct PageBench {
+	int niter;
+	uint32_t nalloc[NCPU];
+};
+
+// Allocate and free single pages as fast as possible, on every CPU
+// that the benchmark is running on at once.
+static void
+page_bench_worker(void *arg)
+{
+	struct PageBench *b = arg;
+	struct Page *blk[MAGBENCH_NBLOCK];
+	int id = cpunum(), i, j;
+
+	for (i = 0; i < b->niter; i++) {
+		for (j = 0; j < MAGBENCH_NBLOCK; j++)
+			if ((blk[j] = page_alloc(0)) == NULL)
+				break;
+		b->nalloc[id] += j;
+		while (--j >= 0)
+			page_free(blk[j]);
+	}
+}
+
+// Run page_bench_worker() on n CPUs, this one included, and return
+// the total allocations per second.
+static uint64_t
+page_bench_run(int n, int niter)
+{
+	static struct PageBench b;
+	uint64_t cycles[NCPU], rate = 0;
+	int id[NCPU], i;
+
+	memset(&b, 0, sizeof(b));
+	b.niter = niter;
+	n = cpu_run_n(n, page_bench_worker, &b, id, cycles);
+	for (i = 0; i < n; i++)
+		rate += tsc_freq() * b.nalloc[id[i]] / (cycles[i] ? cycles[i] : 1);
+	return rate;
+}
+
+// Compare single-page allocation throughput with and without the
+// per-CPU magazines, on 1, 2 and 4 CPUs.
+void
+page_mag_bench(int niter)
+{
+	static const int ncpus[] = { 1, 2, 4 };
+	uint64_t shared, mag;
+	int i, n;
+
+	cprintf("%-5s %20s %20s\n", "cpus", "free list allocs/s",
+		"magazine allocs/s");
+	for (i = 0; i < sizeof(ncpus) / sizeof(ncpus[0]); i++) {
+		n = ncpus[i];
+		if (n > ncpu) {
+			cprintf("%-5d %20s %20s\n", n, "-", "-");
+			continue;
+		}
+		page_nomag = 1;
+		shared = page_bench_run(n, niter);
+		page_nomag = 0;
+		mag = page_bench_run(n, niter);
+		cprintf("%-5d %20llu %20llu\n", n, shared, mag);
+	}
+}
+
+//
+// Check that pages from the zero pool come out zeroed, even after
+// their last user dirtied them.
+//
+static void
+check_zero_pool(void)
+{
+	struct PageMagazine *pm = &page_mags[cpunum()];
+	struct Page *pp;
+	uint32_t *p, hit0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		pp = page_alloc(0);
+		assert(pp);
+		memset(page2kva(pp), 0xAA, PGSIZE);
+		page_free(pp);
+	}
+	for (i = 0; i < 4; i++)
+		page_zero_idle();
+	assert(zero_pool_count == 4);
+
+	hit0 = pm->pm_zerohit;
+	pp = page_alloc(ALLOC_ZERO);
+	assert(pp && pm->pm_zerohit == hit0 + 1);
+	p = page2kva(pp);
+	for (i = 0; i < PGSIZE / 4; i++)
+		assert(p[i] == 0);
+	page_free(pp);
+
+	while ((pp = zero_pool_get()) != NULL)
+		page_free(pp);
+	pm->pm_zerohit = hit0;
+	zero_nfilled = 0;
+	zero_fillcycles = 0;
+
+	cprintf("check_zero_pool() succeeded!\n");
+}
+
+//
+// Check copy-on-write duplication: both sides share every page until
+// one of them writes, the writer gets a copy only while the page is
+// still shared, and read-only pages are never copied.  The writes
+// are real ones through the duplicated page tables, so this needs the
+// IDT for its page faults.
+//
+void
+check_cow(void)
+{
+	struct Env *e;
+	pde_t *parent, *child;
+	struct Page *pp[2], *cp;
+	pte_t *ppte, *cpte;
+	uint32_t ncopy0 = cow_ncopy, nreuse0 = cow_nreuse;
+	int i;
+
+	assert(pgdir_alloc(&parent) == 0);
+	for (i = 0; i < 2; i++) {
+		assert((pp[i] = page_alloc(0)) != NULL);
+		*(uint32_t *) page2kva(pp[i]) = 0x600d0000 + i;
+	}
+	// one writable page and one read-only page
+	assert(page_insert(parent, pp[0], (void *) UTEXT, PTE_U | PTE_W) == 0);
+	assert(page_insert(parent, pp[1], (void *) (UTEXT + PGSIZE), PTE_U) == 0);
+
+	assert(pgdir_alloc(&child) == 0);
+	assert(pgdir_dup_cow(child, parent) == 0);
+
+	// shared, and read-only on both sides
+	assert(page_lookup(parent, (void *) UTEXT, &ppte) == pp[0]);
+	assert(page_lookup(child, (void *) UTEXT, &cpte) == pp[0]);
+	assert(pp[0]->pp_ref == 2);
+	assert((*ppte & (PTE_W | PTE_COW)) == PTE_COW);
+	assert((*cpte & (PTE_W | PTE_COW)) == PTE_COW);
+	assert(page_lookup(child, (void *) (UTEXT + PGSIZE), &cpte) == pp[1]);
+	assert(pp[1]->pp_ref == 2 && !(*cpte & (PTE_W | PTE_COW)));
+	assert(pgdir_cow_fault(child, UTEXT + PGSIZE) == -E_FAULT);
+
+	// The child writes: it gets a copy, and the parent's page is
+	// untouched.
+	lcr3(PADDR(child));
+	*(volatile uint32_t *) UTEXT = 0xc41d;
+	lcr3(boot_cr3);
+	assert(cow_ncopy == ncopy0 + 1);
+	cp = page_lookup(child, (void *) UTEXT, &cpte);
+	assert(cp != pp[0] && cp->pp_ref == 1);
+	assert((*cpte & (PTE_W | PTE_COW)) == PTE_W);
+	assert(*(uint32_t *) page2kva(cp) == 0xc41d);
+	assert(pp[0]->pp_ref == 1);
+	assert(*(uint32_t *) page2kva(pp[0]) == 0x600d0000);
+
+	// The parent is the page's only user now, so its write takes the
+	// page back without copying.
+	lcr3(PADDR(parent));
+	*(volatile uint32_t *) UTEXT = 0x9a2e;
+	lcr3(boot_cr3);
+	assert(cow_nreuse == nreuse0 + 1 && cow_ncopy == ncopy0 + 1);
+	assert(page_lookup(parent, (void *) UTEXT, &ppte) == pp[0]);
+	assert((*ppte & (PTE_W | PTE_COW)) == PTE_W);
+	assert(*(uint32_t *) page2kva(pp[0]) == 0x9a2e);
+
+	pgdir_free(child);
+	assert(pp[1]->pp_ref == 1);
+	pgdir_free(parent);
+
+	// An environment can't mark a read-only page copy-on-write
+	// itself, and so get to write it.
+	assert(env_alloc(&e, 0) == 0);
+	assert((pp[1] = page_alloc(0)) != NULL);
+	assert(env_page_insert(e, pp[1], (void *) UTEXT, PTE_U) == 0);
+	curenv = e;
+	assert(syscall(SYS_page_map, 0, UTEXT, 0, UTEXT + PGSIZE,
+		       PTE_P | PTE_U | PTE_COW) == -E_INVAL);
+	assert(syscall(SYS_page_map, 0, UTEXT, 0, UTEXT,
+		       PTE_P | PTE_U | PTE_COW) == -E_INVAL);
+	assert(syscall(SYS_page_map, 0, UTEXT, 0, UTEXT + PGSIZE,
+		       PTE_P | PTE_U) == 0);
+	curenv = NULL;
+	assert(page_lookup(e->env_pgdir, (void *) UTEXT, &ppte) == pp[1]);
+	assert(!(*ppte & (PTE_W | PTE_COW)));
+	env_free(e);
+
+	cow_ncopy = ncopy0;
+	cow_nreuse = nreuse0;
+	cprintf("check_cow() succeeded!\n");
+}
+
+// Build an address space with 'npg' writable pages from UTEXT up,
+// each one dirtied.
+static pde_t *
+fork_bench_space(int npg)
+{
+	struct Page *pp;
+	pde_t *pgdir;
+	int i, r;
+
+	if ((r = pgdir_alloc(&pgdir)) < 0)
+		panic("fork_bench_space: %e", r);
+	for (i = 0; i < npg; i++) {
+		if ((pp = page_alloc(0)) == NULL)
+			panic("fork_bench_space: out of memory");
+		*(uint32_t *) page2kva(pp) = i;
+		if ((r = page_insert(pgdir, pp, (void *) (UTEXT + i * PGSIZE),
+				     PTE_U | PTE_W)) < 0)
+			panic("fork_bench_space: %e", r);
+	}
+	return pgdir;
+}
+
+// Write to each of the 'npg' pages from UTEXT up in address space
+// 'pgdir', taking whatever page faults that costs.
+static void
+fork_bench_touch(pde_t *pgdir, int npg)
+{
+	int i;
+
+	lcr3(PADDR(pgdir));
+	for (i = 0; i < npg; i++)
+		*(volatile uint32_t *) (UTEXT + i * PGSIZE) += 1;
+	lcr3(boot_cr3);
+}
+
+// Cycles for one duplicate of 'parent' with 'dup', optionally
+// written all over by the child, then freed: a fork+exit, without
+// the environment around it.
+static uint64_t
+fork_bench_one(pde_t *parent, int (*dup)(pde_t *, pde_t *), int npg,
+	       bool touch)
+{
+	pde_t *child;
+	uint64_t t0 = read_tsc();
+	int r;
+
+	if ((r = pgdir_alloc(&child)) < 0 || (r = dup(child, parent)) < 0)
+		panic("fork_bench: %e", r);
+	if (touch)
+		fork_bench_touch(child, npg);
+	pgdir_free(child);
+	return read_tsc() - t0;
+}
+
+//
+// Compare fork+exit latency with eager copying and copy-on-write,
+// for 1MB, 16MB and 64MB address spaces.  "cow+write" has the child
+// write every page before it exits, which is the worst case for
+// copy-on-write.  Sizes that don't fit twice in free memory are
+// skipped.
+//
+void
+pmap_fork_bench(int niter)
+{
+	static const int sizes[] = { 1, 16, 64 };	// MB
+	uint64_t eager, cow, cowtouch, reuse, t0, us = tsc_freq() / 1000000;
+	uint32_t ncopy0 = cow_ncopy, nreuse0 = cow_nreuse;
+	pde_t *parent;
+	int i, j, npg;
+
+	cprintf("%-6s %12s %12s %12s %16s\n", "size", "eager us",
+		"cow us", "cow+write us", "reuse cyc/page");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		npg = (sizes[i] << 20) / PGSIZE;
+		// the parent, an eager copy, and their page tables
+		if (2 * (npg + npg / NPTENTRIES + 2) + PAGE_MAGSIZE * ncpu
+		    > page_nfree) {
+			cprintf("%-6d %12s %12s %12s %16s\n", sizes[i],
+				"-", "-", "-", "-");
+			continue;
+		}
+
+		parent = fork_bench_space(npg);
+		eager = cow = cowtouch = reuse = 0;
+		for (j = 0; j < niter; j++) {
+			eager += fork_bench_one(parent, pgdir_dup_copy, npg, 0);
+			cow += fork_bench_one(parent, pgdir_dup_cow, npg, 0);
+			cowtouch += fork_bench_one(parent, pgdir_dup_cow,
+						   npg, 1);
+			// The parent's pages are all unshared again, but
+			// still marked copy-on-write: its next writes take
+			// the no-copy path.
+			t0 = read_tsc();
+			fork_bench_touch(parent, npg);
+			reuse += read_tsc() - t0;
+		}
+		pgdir_free(parent);
+
+		cprintf("%-6d %12llu %12llu %12llu %16llu\n", sizes[i],
+			eager / niter / us, cow / niter / us,
+			cowtouch / niter / us, reuse / niter / npg);
+	}
+	cprintf("copy-on-write faults: %u copied, %u reused\n",
+		cow_ncopy - ncopy0, cow_nreuse - nreuse0);
+}
+
+//
+// Check user_mem_check() against user_mem_check_walk(), which does
+// the same job the simple way, on a mix of writable, read-only,
+// copy-on-write, demand-zero and unmapped pages.
+//
+void
+check_user_mem(void)
+{
+	static const int perms[] = { 0, PTE_W };
+	struct Env *e;
+	struct Page *pp;
+	uintptr_t va, bad;
+	uint32_t seed = 1;
+	size_t len;
+	int i, j, r;
+
+	assert(env_alloc(&e, 0) == 0);
+	// UTEXT: 4 writable pages, then 1 read-only, then 1 copy-on-write.
+	for (i = 0; i < 6; i++) {
+		assert((pp = page_alloc(0)) != NULL);
+		assert(env_page_insert(e, pp, (void *) (UTEXT + i * PGSIZE),
+				       i == 4 ? PTE_U : PTE_U | PTE_W) == 0);
+	}
+	*pgdir_walk(e->env_pgdir, (void *) (UTEXT + 5 * PGSIZE), 0) ^= PTE_W | PTE_COW;
+	// then 2 demand-zero pages, a hole, and 2 more pages in the next
+	// page table
+	assert(env_region_add(e, UTEXT + 6 * PGSIZE, 2 * PGSIZE, PTE_U | PTE_W) == 0);
+	for (i = 0; i < 2; i++) {
+		assert((pp = page_alloc(0)) != NULL);
+		assert(env_page_insert(e, pp,
+				       (void *) (UTEXT + PTSIZE + i * PGSIZE),
+				       PTE_U | PTE_W) == 0);
+	}
+	// and, with no page table under it, a page table's worth of
+	// demand-zero pages: half writable, half read-only
+	assert(env_region_add(e, 5 * PTSIZE, PTSIZE / 2, PTE_U | PTE_W) == 0);
+	assert(env_region_add(e, 5 * PTSIZE + PTSIZE / 2, PTSIZE / 2, PTE_U) == 0);
+
+	lcr3(e->env_cr3);
+	assert(user_mem_check(e, (void *) (UTEXT + 8), 4 * PGSIZE - 8, PTE_W) == 0);
+	assert(user_mem_check(e, (void *) UTEXT, 8 * PGSIZE, 0) == 0);
+	assert(user_mem_check(e, (void *) (UTEXT + 100), 6 * PGSIZE, PTE_W) < 0
+	       && user_mem_check_addr == UTEXT + 4 * PGSIZE);
+	assert(user_mem_check(e, (void *) (UTEXT + 5 * PGSIZE), 3 * PGSIZE, PTE_W) == 0);
+	assert(user_mem_check(e, (void *) UTEXT, PTSIZE + PGSIZE, 0) < 0
+	       && user_mem_check_addr == UTEXT + 8 * PGSIZE);
+	assert(user_mem_check(e, (void *) (ULIM - 4), 8, 0) < 0
+	       && user_mem_check_addr == ULIM);
+	assert(user_mem_check(e, (void *) UTEXT, -PGSIZE, 0) < 0);
+	assert(user_mem_check(e, (void *) (KERNBASE + 4), 4, 0) < 0
+	       && user_mem_check_addr == KERNBASE + 4);
+	assert(user_mem_check(e, (void *) 0x1000, 0, PTE_W) == 0);
+	assert(user_mem_check(e, (void *) (5 * PTSIZE), PTSIZE / 2, PTE_W) == 0);
+	assert(user_mem_check(e, (void *) (5 * PTSIZE), PTSIZE, 0) == 0);
+	assert(user_mem_check(e, (void *) (5 * PTSIZE + 8), PTSIZE, PTE_W) < 0
+	       && user_mem_check_addr == 5 * PTSIZE + PTSIZE / 2);
+	assert(user_mem_check(e, (void *) (5 * PTSIZE + 8), PTSIZE, 0) < 0
+	       && user_mem_check_addr == 6 * PTSIZE);
+
+	// and agree with the slow version everywhere around there
+	for (i = 0; i < 2000; i++) {
+		va = UTEXT - 2 * PGSIZE + check_rand(&seed) % (PTSIZE + 6 * PGSIZE);
+		len = check_rand(&seed) % (12 * PGSIZE);
+		j = check_rand(&seed) % 2;
+		r = user_mem_check(e, (void *) va, len, perms[j]);
+		bad = user_mem_check_addr;
+		assert(user_mem_check_walk(e, (void *) va, len, perms[j]) == r);
+		assert(r == 0 || user_mem_check_addr == bad);
+	}
+	lcr3(boot_cr3);
+
+	env_free(e);
+	cprintf("check_user_mem() succeeded!\n");
+}
+
+//
+// Time user_mem_check() and user_mem_check_walk() on 4KB, 1MB and
+// 16MB buffers, all mapped.
+//
+void
+pmap_umem_bench(int niter)
+{
+	static const size_t sizes[] = { 4 << 10, 1 << 20, 16 << 20 };
+	uint64_t t0, walk, fast;
+	struct Env *e;
+	struct Page *pp;
+	int i, j, r, npg = (16 << 20) / PGSIZE;
+
+	if (npg + npg / NPTENTRIES + PAGE_MAGSIZE * ncpu > page_nfree) {
+		cprintf("umembench: not enough free memory\n");
+		return;
+	}
+	if ((r = env_alloc(&e, 0)) < 0)
+		panic("umembench: %e", r);
+	for (i = 0; i < npg; i++)
+		if ((pp = page_alloc(0)) == NULL
+		    || env_page_insert(e, pp, (void *) (UTEXT + i * PGSIZE),
+				       PTE_U | PTE_W) < 0)
+			panic("umembench: out of memory");
+
+	lcr3(e->env_cr3);
+	cprintf("%-8s %14s %14s\n", "size", "walk cycles", "vpt cycles");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		t0 = read_tsc();
+		for (j = 0; j < niter; j++)
+			if (user_mem_check_walk(e, (void *) UTEXT, sizes[i], PTE_W) < 0)
+				panic("umembench: walk check failed");
+		walk = read_tsc() - t0;
+		t0 = read_tsc();
+		for (j = 0; j < niter; j++)
+			if (user_mem_check(e, (void *) UTEXT, sizes[i], PTE_W) < 0)
+				panic("umembench: vpt check failed");
+		fast = read_tsc() - t0;
+		cprintf("%-6uK %14llu %14llu\n", sizes[i] >> 10,
+			walk / niter, fast / niter);
+	}
+	lcr3(boot_cr3);
+	env_free(e);
+}
+
+//
+// Check copyin() and copyout(): they copy what they can reach, take
+// demand-zero and copy-on-write faults in their stride, and turn any
+// other fault into -E_FAULT.
+//
+void
+check_copyuser(void)
+{
+	struct Env *e, *saved = curenv;
+	struct Page *pp[2];
+	char buf[3 * PGSIZE];
+	int i;
+
+	assert(env_alloc(&e, 0) == 0);
+	// UTEXT: a copy-on-write page, then a read-only one, then 2
+	// demand-zero pages; nothing after them
+	for (i = 0; i < 2; i++) {
+		assert((pp[i] = page_alloc(0)) != NULL);
+		memset(page2kva(pp[i]), 'a' + i, PGSIZE);
+		assert(env_page_insert(e, pp[i], (void *) (UTEXT + i * PGSIZE),
+				       i == 0 ? PTE_U | PTE_COW : PTE_U) == 0);
+	}
+	assert(env_region_add(e, UTEXT + 2 * PGSIZE, 2 * PGSIZE, PTE_U | PTE_W) == 0);
+
+	curenv = e;
+	lcr3(e->env_cr3);
+
+	// reads, at odd offsets and lengths, into the demand-zero pages
+	memset(buf, 'x', sizeof(buf));
+	assert(copyin(buf, (void *) (UTEXT + PGSIZE - 3), PGSIZE + 10) == 0);
+	assert(buf[0] == 'a' && buf[3] == 'b' && buf[PGSIZE + 2] == 'b');
+	assert(buf[PGSIZE + 3] == 0 && buf[PGSIZE + 9] == 0);
+	assert(buf[PGSIZE + 10] == 'x');
+	assert(e->env_nzfod == 1);
+
+	// writes
+	assert(copyout((void *) (UTEXT + 5), "hello", 5) == 0);
+	assert(memcmp((char *) page2kva(pp[0]) + 5, "hello", 5) == 0);
+	assert(*pgdir_walk(e->env_pgdir, (void *) UTEXT, 0) & PTE_W);
+	assert(copyout((void *) (UTEXT + 3 * PGSIZE + 1), buf, 7) == 0);
+
+	// and the ones that must fail
+	assert(copyout((void *) (UTEXT + PGSIZE - 2), "abcdef", 6) == -E_FAULT);
+	assert(((char *) page2kva(pp[1]))[0] == 'b');
+	assert(copyin(buf, (void *) (UTEXT + 4 * PGSIZE - 4), 8) == -E_FAULT);
+	assert(copyin(buf, (void *) (UTEXT - PGSIZE), 1) == -E_FAULT);
+	assert(copyin(buf, (void *) (ULIM - 4), 8) == -E_FAULT);
+	assert(copyout((void *) KERNBASE, buf, 4) == -E_FAULT);
+	assert(copyin(buf, (void *) UTEXT, 0) == 0);
+
+	lcr3(boot_cr3);
+	curenv = saved;
+	env_free(e);
+	cprintf("check_copyuser() succeeded!\n");
+}
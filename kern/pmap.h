@@ -0,0 +1,120 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERNBASE, where the machine's maximum 256MB of physical memory is mapped --
+ * and returns the corresponding physical address.  It panics if you pass it a
+ * non-kernel virtual address.
+ */
+#define PADDR(kva)						\
+({								\
+	physaddr_t __m_kva = (physaddr_t) (kva);		\
+	if (__m_kva < KERNBASE)					\
+		panic("PADDR called with invalid kva %08lx", __m_kva);\
+	__m_kva - KERNBASE;					\
+})
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address. */
+#define KADDR(pa)						\
+({								\
+	physaddr_t __m_pa = (pa);				\
+	uint32_t __m_ppn = PPN(__m_pa);				\
+	if (__m_ppn >= npage)					\
+		panic("KADDR called with invalid pa %08lx", __m_pa);\
+	(void*) (__m_pa + KERNBASE);				\
+})
+
+
+extern char bootstacktop[], bootstack[];
+
+extern struct Page *pages;
+extern size_t npage;
+
+extern physaddr_t boot_cr3;
+extern pde_t *boot_pgdir;
+
+// Values for the alloc_flags argument of page_alloc()
+#define ALLOC_ZERO	0x1		// zero the page(s) before returning
+
+// The buddy allocator's largest block is 2^PAGE_MAXORDER pages (4MB)
+#define PAGE_MAXORDER	10
+
+void	i386_vm_init(void);
+void	vm_init_percpu(void);
+void	seg_init_percpu(void);
+void	*mmio_map_region(physaddr_t pa, size_t size);
+void	boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size,
+			 physaddr_t pa, int perm);
+void	pmap_cr3_bench(int niter);
+
+void	page_init(void);
+struct Page *page_alloc(int alloc_flags);
+struct Page *page_alloc_order(int order, int alloc_flags);
+void	page_free(struct Page *pp);
+void	page_free_order(struct Page *pp, int order);
+void	page_decref(struct Page *pp);
+void	page_zero_idle(void);
+void	page_zero_info(void);
+void	page_alloc_bench(int niter);
+void	page_mag_bench(int niter);
+
+pte_t	*pgdir_walk(pde_t *pgdir, const void *va, int create);
+int	page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm);
+void	page_remove(pde_t *pgdir, void *va);
+struct Page *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
+void	tlb_invalidate(pde_t *pgdir, void *va);
+
+int	pgdir_alloc(pde_t **pgdir_store);
+void	pgdir_free(pde_t *pgdir);
+int	pgdir_dup_cow(pde_t *dst, pde_t *src);
+int	pgdir_dup_copy(pde_t *dst, pde_t *src);
+int	pgdir_cow_fault(pde_t *pgdir, uintptr_t va);
+void	check_cow(void);
+void	pmap_fork_bench(int niter);
+
+struct Env;
+extern uintptr_t user_mem_check_addr;
+int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
+int	user_mem_check_walk(struct Env *env, const void *va, size_t len, int perm);
+int	copyin(void *dst, const void *usrc, size_t len);
+int	copyout(void *udst, const void *src, size_t len);
+void	check_user_mem(void);
+void	check_copyuser(void);
+void	pmap_umem_bench(int niter);
+
+static inline ppn_t
+page2ppn(struct Page *pp)
+{
+	return pp - pages;
+}
+
+static inline physaddr_t
+page2pa(struct Page *pp)
+{
+	return page2ppn(pp) << PGSHIFT;
+}
+
+static inline struct Page*
+pa2page(physaddr_t pa)
+{
+	if (PPN(pa) >= npage)
+		panic("pa2page called with invalid pa");
+	return &pages[PPN(pa)];
+}
+
+static inline void*
+page2kva(struct Page *pp)
+{
+	return KADDR(page2pa(pp));
+}
+
+#endif /* !JOS_KERN_PMAP_H */
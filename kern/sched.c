@@ -0,0 +1,670 @@
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/kclock.h>
+#include <kern/sched.h>
+#include <kern/fpu.h>
+#include <kern/spinlock.h>
+
+// How often each CPU evens out its run queue against the busiest one
+#define SCHED_BALANCE_TICKS	(HZ / 10)
+
+TAILQ_HEAD(Env_runq, Env);
+
+// A CPU's run queue: a FIFO of runnable environments for each
+// priority, and a bitmap with bit p set while queue p is non-empty.
+// Choosing the next environment is a find-first-set on the bitmap and
+// a look at the head of one queue, however many environments there
+// are.  The environment a CPU is running is on no queue.
+//
+// Each CPU schedules from its own queue, so context switches on
+// different CPUs don't contend.  Environments only move between
+// queues when a CPU pulls them over: all at once when it runs dry
+// (sched_steal()), or a few at a time on the clock (sched_balance()).
+//
+// The boot CPU always schedules.  The others only do while cpu_run()
+// has them in a loop around sched_yield(), between sched_start() and
+// sched_stop(); the rest of the time their queues are offline, and
+// stay empty.
+struct RunQueue {
+	struct spinlock rq_lock;	// protects the queue and e->env_cpu
+	volatile bool rq_online;	// its CPU schedules from it
+	uint32_t rq_bitmap;
+	int rq_nrunnable;
+	struct Env_runq rq_queue[NPRIO];
+
+	// Only ever touched by the queue's own CPU
+	uint32_t rq_ticks;		// clock ticks
+	volatile bool rq_balance;	// sched_balance() at the next yield
+	uint32_t rq_nsteal;		// environments stolen
+	uint32_t rq_nbalance;		// environments pulled by balancing
+} __attribute__((aligned(64)));
+
+static struct RunQueue runqs[NCPU];
+
+void
+sched_init(void)
+{
+	struct RunQueue *rq;
+	int p;
+
+	for (rq = runqs; rq < runqs + NCPU; rq++) {
+		spin_initlock(&rq->rq_lock);
+		for (p = 0; p < NPRIO; p++)
+			TAILQ_INIT(&rq->rq_queue[p]);
+	}
+	runqs[cpunum()].rq_online = 1;
+}
+
+// Add e to the tail of its priority's queue.  The caller holds
+// rq_lock.
+static void
+runq_put(struct RunQueue *rq, struct Env *e)
+{
+	TAILQ_INSERT_TAIL(&rq->rq_queue[e->env_prio], e, env_runlink);
+	rq->rq_bitmap |= 1 << e->env_prio;
+	rq->rq_nrunnable++;
+}
+
+// Take e off its queue.  The caller holds rq_lock.
+static void
+runq_remove(struct RunQueue *rq, struct Env *e)
+{
+	struct Env_runq *q = &rq->rq_queue[e->env_prio];
+
+	TAILQ_REMOVE(q, e, env_runlink);
+	if (TAILQ_EMPTY(q))
+		rq->rq_bitmap &= ~(1 << e->env_prio);
+	rq->rq_nrunnable--;
+}
+
+// Take the environment that has waited longest at the highest
+// priority that has any, or return NULL.  The caller holds rq_lock.
+static struct Env *
+runq_pick(struct RunQueue *rq)
+{
+	struct Env *e;
+
+	if (rq->rq_bitmap == 0)
+		return NULL;
+	e = TAILQ_FIRST(&rq->rq_queue[__builtin_ffs(rq->rq_bitmap) - 1]);
+	runq_remove(rq, e);
+	return e;
+}
+
+// Lock the run queue e is on, or would go on.  e->env_cpu only
+// changes under the lock of the queue it names, so look again once
+// that lock is held.
+static struct RunQueue *
+env_runq_lock(struct Env *e)
+{
+	struct RunQueue *rq;
+
+	for (;;) {
+		rq = &runqs[e->env_cpu];
+		spin_lock(&rq->rq_lock);
+		if (rq == &runqs[e->env_cpu])
+			return rq;
+		spin_unlock(&rq->rq_lock);
+	}
+}
+
+// Lock two run queues, always in the same order.
+static void
+runq_lock2(struct RunQueue *a, struct RunQueue *b)
+{
+	if (a > b) {
+		struct RunQueue *t = a;
+		a = b;
+		b = t;
+	}
+	spin_lock(&a->rq_lock);
+	spin_lock(&b->rq_lock);
+}
+
+// Like runq_pick(), but pass over the environment whose FPU state is
+// in the registers of rq's CPU: no other CPU can save it from there.
+// The owner only changes to the environment that CPU is running, which
+// is on no queue, and only after the old owner's state is saved.
+static struct Env *
+runq_pick_movable(struct RunQueue *rq)
+{
+	struct Env *e, *owner = cpus[rq - runqs].cpu_fpu_owner;
+	uint32_t bitmap = rq->rq_bitmap;
+	int p;
+
+	for (; bitmap; bitmap &= ~(1 << p)) {
+		p = __builtin_ffs(bitmap) - 1;
+		TAILQ_FOREACH(e, &rq->rq_queue[p], env_runlink)
+			if (e != owner) {
+				runq_remove(rq, e);
+				return e;
+			}
+	}
+	return NULL;
+}
+
+// Move up to n environments from 'from' to 'to', best first, and
+// return how many moved.  The caller holds both locks.
+static int
+runq_move(struct RunQueue *to, struct RunQueue *from, int n)
+{
+	struct Env *e;
+	int i;
+
+	for (i = 0; i < n && (e = runq_pick_movable(from)) != NULL; i++) {
+		e->env_cpu = to - runqs;
+		runq_put(to, e);
+	}
+	return i;
+}
+
+// The other CPU with the most runnable environments queued, or NULL if
+// none has any.  This peeks without locking; the caller rechecks.
+static struct RunQueue *
+runq_busiest(struct RunQueue *self)
+{
+	struct RunQueue *rq, *busiest = NULL;
+	int most = 0;
+
+	for (rq = runqs; rq < runqs + ncpu; rq++)
+		if (rq != self && rq->rq_nrunnable > most) {
+			busiest = rq;
+			most = rq->rq_nrunnable;
+		}
+	return busiest;
+}
+
+// rq's CPU has nothing to run: take half of the busiest queue's
+// environments, rounding up so that a lone one moves too.  Returns the
+// number stolen.
+static int
+sched_steal(struct RunQueue *rq)
+{
+	struct RunQueue *victim;
+	int n;
+
+	if ((victim = runq_busiest(rq)) == NULL)
+		return 0;
+	runq_lock2(rq, victim);
+	n = runq_move(rq, victim, (victim->rq_nrunnable + 1) / 2);
+	spin_unlock(&victim->rq_lock);
+	spin_unlock(&rq->rq_lock);
+	rq->rq_nsteal += n;
+	return n;
+}
+
+// Even out rq against the busiest queue, if that one has at least two
+// more waiting.  Stealing only helps CPUs that have run dry; this
+// keeps a queue from staying long while its neighbours stay short.
+static void
+sched_balance(struct RunQueue *rq)
+{
+	struct RunQueue *busiest;
+	int n;
+
+	if ((busiest = runq_busiest(rq)) == NULL
+	    || busiest->rq_nrunnable < rq->rq_nrunnable + 2)
+		return;
+	runq_lock2(rq, busiest);
+	n = (busiest->rq_nrunnable - rq->rq_nrunnable) / 2;
+	if (n > 0)
+		rq->rq_nbalance += runq_move(rq, busiest, n);
+	spin_unlock(&busiest->rq_lock);
+	spin_unlock(&rq->rq_lock);
+}
+
+// The clock interrupt, on every CPU.  Take no locks here: the
+// interrupted code may hold any of them.  Just ask the next
+// sched_yield() to balance now and then.
+void
+sched_tick(void)
+{
+	struct RunQueue *rq = &runqs[cpunum()];
+
+	if (++rq->rq_ticks % SCHED_BALANCE_TICKS == 0)
+		rq->rq_balance = 1;
+}
+
+// This CPU is about to schedule from its own queue.
+void
+sched_start(void)
+{
+	runqs[cpunum()].rq_online = 1;
+}
+
+// This CPU has stopped scheduling.  Unless it's the boot CPU, take its
+// queue offline, handing whatever is on it to the boot CPU's.  Its
+// FPU owner's state goes back to the owner first, so that that one
+// can move too.
+void
+sched_stop(void)
+{
+	struct RunQueue *rq = &runqs[cpunum()];
+	struct RunQueue *boot = &runqs[bootcpu->cpu_id];
+
+	if (rq == boot)
+		return;
+	fpu_save_owner();
+	runq_lock2(rq, boot);
+	rq->rq_online = 0;
+	runq_move(boot, rq, rq->rq_nrunnable);
+	assert(rq->rq_nrunnable == 0);
+	spin_unlock(&boot->rq_lock);
+	spin_unlock(&rq->rq_lock);
+}
+
+// Make e runnable, on the queue of the CPU it last ran on, or the boot
+// CPU's if that CPU has stopped scheduling.
+void
+sched_enqueue(struct Env *e)
+{
+	struct RunQueue *rq;
+
+	while (!(rq = env_runq_lock(e))->rq_online) {
+		e->env_cpu = bootcpu->cpu_id;
+		spin_unlock(&rq->rq_lock);
+	}
+	assert(e->env_status != ENV_RUNNABLE && e->env_status != ENV_FREE);
+	e->env_status = ENV_RUNNABLE;
+	runq_put(rq, e);
+	spin_unlock(&rq->rq_lock);
+}
+
+// Make the runnable environment e not runnable.
+void
+sched_dequeue(struct Env *e)
+{
+	struct RunQueue *rq = env_runq_lock(e);
+
+	assert(e->env_status == ENV_RUNNABLE);
+	runq_remove(rq, e);
+	e->env_status = ENV_NOT_RUNNABLE;
+	spin_unlock(&rq->rq_lock);
+}
+
+// Change e's priority, moving it to its new queue if it's runnable.
+void
+sched_setprio(struct Env *e, int prio)
+{
+	struct RunQueue *rq;
+
+	assert(prio >= 0 && prio < NPRIO);
+	rq = env_runq_lock(e);
+	if (e->env_status == ENV_RUNNABLE) {
+		runq_remove(rq, e);
+		e->env_prio = prio;
+		runq_put(rq, e);
+	} else
+		e->env_prio = prio;
+	spin_unlock(&rq->rq_lock);
+}
+
+// Take the next environment off rq and mark it running, or return
+// NULL.
+static struct Env *
+sched_pick(struct RunQueue *rq)
+{
+	struct Env *e;
+
+	spin_lock(&rq->rq_lock);
+	if ((e = runq_pick(rq)) != NULL)
+		e->env_status = ENV_RUNNING;
+	spin_unlock(&rq->rq_lock);
+	return e;
+}
+
+// Choose a user environment to run on this CPU and make it current:
+// the one on this CPU's queue that has waited longest at the highest
+// priority.  The current environment, if it is still running, goes
+// to the back of its queue first, so that environments of equal
+// priority take turns.  If the queue is empty, steal from another
+// CPU's.
+//
+// This only picks: it returns with the new environment's address
+// space loaded, or with curenv NULL and boot_pgdir loaded if nothing
+// is runnable, and never enters user mode.  The only way into ring 3
+// is env_run(), which takes its environment off the queues itself and
+// runs it until it is destroyed, outside the scheduler.
+void
+sched_yield(void)
+{
+	struct RunQueue *rq = &runqs[cpunum()];
+	struct Env *e;
+
+	if (rq->rq_balance) {
+		rq->rq_balance = 0;
+		sched_balance(rq);
+	}
+
+	// A running environment's env_cpu is this CPU, so it goes back
+	// on this queue.
+	if (curenv && curenv->env_status == ENV_RUNNING) {
+		spin_lock(&rq->rq_lock);
+		curenv->env_status = ENV_RUNNABLE;
+		runq_put(rq, curenv);
+		spin_unlock(&rq->rq_lock);
+	}
+	if ((e = sched_pick(rq)) == NULL && sched_steal(rq) > 0)
+		e = sched_pick(rq);
+
+	curenv = e;
+	fpu_switch(e);
+	if (e) {
+		e->env_runs++;
+		lcr3(e->env_cr3);
+	} else
+		lcr3(boot_cr3);
+}
+
+//
+// Check that sched_yield() runs the highest priority first, takes
+// turns within a priority, and skips environments that aren't
+// runnable; and that an idle CPU steals half of a busier CPU's queue
+// and balancing evens two queues out.
+//
+void
+check_sched(void)
+{
+	struct RunQueue *rq = &runqs[cpunum()], *other;
+	struct Env *e[4], *saved = curenv;
+	uint32_t bitmap0 = rq->rq_bitmap, nsteal0, nbalance0;
+	int i, nrunnable0 = rq->rq_nrunnable;
+	static const int prio[4] = { 5, 5, 3, 10 };
+
+	for (i = 0; i < 4; i++) {
+		assert(env_alloc(&e[i], 0) == 0);
+		assert(e[i]->env_status == ENV_RUNNABLE);
+		assert(e[i]->env_cpu == cpunum());
+		sched_setprio(e[i], prio[i]);
+	}
+	assert(rq->rq_nrunnable == nrunnable0 + 4);
+	assert(rq->rq_bitmap == (bitmap0 | 1 << 3 | 1 << 5 | 1 << 10));
+
+	curenv = NULL;
+	sched_yield();
+	assert(curenv == e[2] && e[2]->env_status == ENV_RUNNING);
+	sched_yield();			// alone at its priority: runs again
+	assert(curenv == e[2] && e[2]->env_runs == 2);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+	assert(curenv == e[0]);
+	sched_yield();
+	assert(curenv == e[1]);
+	sched_yield();
+	assert(curenv == e[0]);
+	sched_setprio(e[3], 0);
+	sched_yield();
+	assert(curenv == e[3]);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+	assert(curenv == e[1]);
+	assert(rq->rq_bitmap == (bitmap0 | 1 << 5));
+
+	lcr3(boot_cr3);
+	curenv = saved;
+	for (i = 0; i < 4; i++)
+		env_free(e[i]);
+	assert(rq->rq_nrunnable == nrunnable0);
+	assert(rq->rq_bitmap == bitmap0);
+
+	// Stealing and balancing need a second queue, which nothing else
+	// schedules from until the other CPUs start.  While its CPU isn't
+	// scheduling, it's offline, and environments that would go there
+	// come here instead.
+	if (ncpu < 2 || nrunnable0 != 0)
+		goto done;
+	other = &runqs[cpunum() == 0 ? 1 : 0];
+	assert(!other->rq_online);
+	assert(env_alloc(&e[0], 0) == 0);
+	sched_dequeue(e[0]);
+	e[0]->env_cpu = other - runqs;
+	sched_enqueue(e[0]);
+	assert(e[0]->env_cpu == cpunum() && other->rq_nrunnable == 0);
+	env_free(e[0]);
+
+	other->rq_online = 1;
+	nsteal0 = rq->rq_nsteal;
+	nbalance0 = rq->rq_nbalance;
+	for (i = 0; i < 4; i++) {
+		assert(env_alloc(&e[i], 0) == 0);
+		sched_dequeue(e[i]);
+		e[i]->env_cpu = other - runqs;
+		sched_enqueue(e[i]);
+	}
+	assert(other->rq_nrunnable == 4);
+
+	// Nothing here: steal two, run one.
+	curenv = NULL;
+	sched_yield();
+	assert(curenv == e[0] && e[0]->env_cpu == cpunum());
+	assert(e[1]->env_cpu == cpunum() && e[2]->env_cpu == other - runqs);
+	assert(rq->rq_nsteal == nsteal0 + 2);
+	assert(rq->rq_nrunnable == 1 && other->rq_nrunnable == 2);
+
+	// One apart isn't worth a move...
+	rq->rq_balance = 1;
+	sched_yield();
+	assert(curenv == e[1] && rq->rq_nbalance == nbalance0);
+	// ...but two apart is.
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_dequeue(e[0]);
+	rq->rq_balance = 1;
+	sched_yield();
+	assert(curenv == e[2] && rq->rq_nbalance == nbalance0 + 1);
+	assert(rq->rq_nrunnable == 0 && other->rq_nrunnable == 1);
+
+	lcr3(boot_cr3);
+	curenv = saved;
+	for (i = 0; i < 4; i++)
+		env_free(e[i]);
+	assert(other->rq_nrunnable == 0);
+	other->rq_online = 0;
+	rq->rq_nsteal = nsteal0;
+	rq->rq_nbalance = nbalance0;
+done:
+	cprintf("check_sched() succeeded!\n");
+}
+
+// The classic round-robin decision, for comparison: the next runnable
+// environment after envs[*last] in envs[] order.
+static struct Env *
+sched_scan(int *last)
+{
+	int i, j;
+
+	for (i = 1; i <= NENV; i++) {
+		j = (*last + i) % NENV;
+		if (envs[j].env_status == ENV_RUNNABLE) {
+			*last = j;
+			return &envs[j];
+		}
+	}
+	return NULL;
+}
+
+//
+// Time a scheduling decision with 10, 100 and 1000 runnable
+// environments on this CPU's queue, spread over four priorities,
+// against a scan of envs[].  Each decision puts the chosen environment
+// straight back, so the set being scheduled never changes; the address
+// space switch isn't counted.
+//
+void
+sched_bench(int niter)
+{
+	static const int counts[] = { 10, 100, 1000 };
+	static struct Env *e[1000];
+	struct RunQueue *rq = &runqs[cpunum()];
+	uint64_t t0, o1, scan;
+	struct Env *pick;
+	int i, j, n, r, last = 0;
+
+	cprintf("%-6s %14s %14s\n", "envs", "O(1) cycles", "scan cycles");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		for (n = 0; n < counts[i]; n++) {
+			if ((r = env_alloc(&e[n], 0)) < 0)
+				break;
+			sched_setprio(e[n], ENV_PRIO_DEFAULT + n % 4);
+		}
+		if (n < counts[i]) {
+			cprintf("%-6d %14s %14s (%e)\n", counts[i], "-", "-", r);
+			goto free;
+		}
+
+		t0 = read_tsc();
+		for (j = 0; j < niter; j++) {
+			spin_lock(&rq->rq_lock);
+			pick = runq_pick(rq);
+			runq_put(rq, pick);
+			spin_unlock(&rq->rq_lock);
+		}
+		o1 = read_tsc() - t0;
+
+		t0 = read_tsc();
+		for (j = 0; j < niter; j++)
+			if (sched_scan(&last) == NULL)
+				panic("sched_bench: nothing runnable");
+		scan = read_tsc() - t0;
+
+		cprintf("%-6d %14llu %14llu\n", counts[i], o1 / niter,
+			scan / niter);
+	free:
+		while (n > 0)
+			env_free(e[--n]);
+	}
+}
+
+#define FANOUT_NJOB	64
+
+struct FanoutBench {
+	int njob;
+	uint64_t quantum;		// cycles
+	volatile uint32_t nfinished[NCPU];	// jobs finished by each CPU
+	uint32_t nquanta[NCPU];
+};
+
+// Quanta each job still has to run, by env index
+static int fanout_left[NENV];
+
+static int
+fanout_nfinished(struct FanoutBench *b)
+{
+	int i, n = 0;
+
+	for (i = 0; i < NCPU; i++)
+		n += b->nfinished[i];
+	return n;
+}
+
+// Schedule the benchmark's jobs on this CPU until every one is done.
+// Each turn a job gets spins for one quantum, with interrupts on so
+// the clock ticks, and then yields.
+static void
+fanout_worker(void *arg)
+{
+	struct FanoutBench *b = arg;
+	int id = cpunum();
+	uint64_t end;
+
+	sched_start();
+	for (;;) {
+		sched_yield();
+		if (!curenv) {
+			if (fanout_nfinished(b) == b->njob)
+				break;
+			asm volatile("pause");
+			continue;
+		}
+		end = read_tsc() + b->quantum;
+		asm volatile("sti");
+		while (read_tsc() < end)
+			/* do nothing */;
+		asm volatile("cli");
+		b->nquanta[id]++;
+		if (--fanout_left[ENVX(curenv->env_id)] == 0) {
+			curenv->env_status = ENV_NOT_RUNNABLE;
+			b->nfinished[id]++;
+		}
+	}
+	sched_stop();
+}
+
+// Fan FANOUT_NJOB jobs out from this CPU and run them on n CPUs, this
+// one included.  Returns quanta run per second, and adds the
+// environments stolen and balanced to *nsteal and *nbalance.
+static uint64_t
+fanout_run(int n, int nquanta, uint32_t *nsteal, uint32_t *nbalance)
+{
+	static struct FanoutBench b;
+	struct Env *e[FANOUT_NJOB], *saved = curenv;
+	uint32_t steal0 = 0, balance0 = 0;
+	uint64_t cycles[NCPU], total = 0, maxcycles = 0;
+	int id[NCPU], i, r;
+
+	memset(&b, 0, sizeof(b));
+	b.quantum = tsc_freq() / 10000;		// 100us
+	for (i = 0; i < ncpu; i++) {
+		steal0 += runqs[i].rq_nsteal;
+		balance0 += runqs[i].rq_nbalance;
+	}
+
+	for (b.njob = 0; b.njob < FANOUT_NJOB; b.njob++) {
+		if ((r = env_alloc(&e[b.njob], 0)) < 0) {
+			cprintf("fanout_run: %e\n", r);
+			break;
+		}
+		fanout_left[ENVX(e[b.njob]->env_id)] = nquanta;
+	}
+
+	curenv = NULL;
+	n = cpu_run_n(n, fanout_worker, &b, id, cycles);
+	for (i = 0; i < n; i++) {
+		total += b.nquanta[id[i]];
+		if (cycles[i] > maxcycles)
+			maxcycles = cycles[i];
+	}
+	curenv = saved;
+
+	for (i = 0; i < b.njob; i++)
+		env_free(e[i]);
+	for (i = 0; i < ncpu; i++) {
+		*nsteal += runqs[i].rq_nsteal;
+		*nbalance += runqs[i].rq_nbalance;
+	}
+	*nsteal -= steal0;
+	*nbalance -= balance0;
+	return tsc_freq() * total / (maxcycles ? maxcycles : 1);
+}
+
+//
+// Throughput of a CPU-bound fan-out: one CPU makes 64 jobs of nquanta
+// 100us quanta each, and 1, 2, 4 and 8 CPUs run them.  The other CPUs
+// start out with empty queues, so everything they run they got by
+// stealing or balancing.
+//
+void
+sched_fanout_bench(int nquanta)
+{
+	static const int ncpus[] = { 1, 2, 4, 8 };
+	uint32_t nsteal, nbalance;
+	uint64_t rate;
+	int i, n;
+
+	cprintf("%-5s %12s %8s %8s\n", "cpus", "quanta/s", "stolen",
+		"balanced");
+	for (i = 0; i < sizeof(ncpus) / sizeof(ncpus[0]); i++) {
+		n = ncpus[i];
+		if (n > ncpu) {
+			cprintf("%-5d %12s %8s %8s\n", n, "-", "-", "-");
+			continue;
+		}
+		nsteal = nbalance = 0;
+		rate = fanout_run(n, nquanta, &nsteal, &nbalance);
+		cprintf("%-5d %12llu %8u %8u\n", n, rate, nsteal, nbalance);
+	}
+}
@@ -0,0 +1,24 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SCHED_H
+#define JOS_KERN_SCHED_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void	sched_init(void);
+void	sched_start(void);
+void	sched_stop(void);
+void	sched_enqueue(struct Env *e);
+void	sched_dequeue(struct Env *e);
+void	sched_setprio(struct Env *e, int prio);
+void	sched_yield(void);
+void	sched_tick(void);
+
+void	check_sched(void);
+void	sched_bench(int niter);
+void	sched_fanout_bench(int nquanta);
+
+#endif	// !JOS_KERN_SCHED_H
@@ -0,0 +1,446 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/batch.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+#include <kern/syscall.h>
+#include <kern/console.h>
+
+// Print a string to the system console.
+// The string is exactly 'len' characters long.
+// Returns -E_FAULT if the memory isn't the environment's to read.
+static int
+sys_cputs(const char *s, size_t len)
+{
+	char buf[128];
+	size_t n;
+	int r;
+
+	for (; len > 0; s += n, len -= n) {
+		n = MIN(len, sizeof(buf));
+		if ((r = copyin(buf, s, n)) < 0)
+			return r;
+		cprintf("%.*s", n, buf);
+	}
+	return 0;
+}
+
+// Read a character from the system console without blocking.
+// Returns the character, or 0 if there is no input waiting.
+static int
+sys_cgetc(void)
+{
+	return cons_getc();
+}
+
+// Returns the current environment's envid.
+static envid_t
+sys_getenvid(void)
+{
+	return curenv->env_id;
+}
+
+// Destroy a given environment (possibly the currently running environment).
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid,
+//		or it's running on another CPU.
+static int
+sys_env_destroy(envid_t envid)
+{
+	int r;
+	struct Env *e;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (e != curenv && e->env_status == ENV_RUNNING)
+		return -E_BAD_ENV;
+	env_destroy(e);
+	return 0;
+}
+
+// Whether va and perm are fit for mapping a page into an environment:
+// va page-aligned and below UTOP, PTE_U and PTE_P set in perm, and
+// nothing outside PTE_ALLOWED.  PTE_COW is the kernel's to set: a
+// copy-on-write fault on a page nobody else maps just makes it
+// writable, so it would turn a read-only page into a writable one.
+static bool
+map_ok(void *va, int perm)
+{
+	return (uintptr_t) va < UTOP && PGOFF(va) == 0
+		&& (perm & (PTE_U | PTE_P)) == (PTE_U | PTE_P)
+		&& (perm & ~PTE_ALLOWED) == 0
+		&& !(perm & PTE_COW);
+}
+
+// Allocate a page of memory and map it at 'va' with permission
+// 'perm' in the address space of 'envid'.
+// The page's contents are set to 0.
+// If a page is already mapped at 'va', that page is unmapped as a
+// side effect.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_INVAL if perm is inappropriate (see map_ok).
+//	-E_NO_MEM if there's no memory to allocate the new page,
+//		or to allocate any necessary page tables.
+static int
+sys_page_alloc(envid_t envid, void *va, int perm)
+{
+	struct Env *e;
+	struct Page *pp;
+	int r;
+
+	if (!map_ok(va, perm))
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+		return -E_NO_MEM;
+	if ((r = env_page_insert(e, pp, va, perm)) < 0) {
+		page_free(pp);
+		return r;
+	}
+	return 0;
+}
+
+// Map the page of memory at 'srcva' in srcenvid's address space
+// at 'dstva' in dstenvid's address space with permission 'perm'.
+// Perm has the same restrictions as in sys_page_alloc, except
+// that it also must not grant write access to a read-only
+// page.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
+//		or the caller doesn't have permission to change one of them.
+//	-E_INVAL if srcva >= UTOP or srcva is not page-aligned,
+//		or dstva >= UTOP or dstva is not page-aligned.
+//	-E_INVAL is srcva is not mapped in srcenvid's address space.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if (perm & PTE_W), but srcva is read-only in srcenvid's
+//		address space.
+//	-E_NO_MEM if there's no memory to allocate any necessary page tables.
+static int
+sys_page_map(envid_t srcenvid, void *srcva,
+	     envid_t dstenvid, void *dstva, int perm)
+{
+	struct Env *src, *dst;
+	struct Page *pp;
+	pte_t *pte;
+	int r;
+
+	if ((uintptr_t) srcva >= UTOP || PGOFF(srcva) || !map_ok(dstva, perm))
+		return -E_INVAL;
+	if ((r = envid2env(srcenvid, &src, 1)) < 0
+	    || (r = envid2env(dstenvid, &dst, 1)) < 0)
+		return r;
+	if ((pp = page_lookup(src->env_pgdir, srcva, &pte)) == NULL)
+		return -E_INVAL;
+	if ((perm & PTE_W) && !(*pte & PTE_W))
+		return -E_INVAL;
+	return env_page_insert(dst, pp, dstva, perm);
+}
+
+// Unmap the page of memory at 'va' in the address space of 'envid'.
+// If no page is mapped, the function silently succeeds.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va >= UTOP, or va is not page-aligned.
+static int
+sys_page_unmap(envid_t envid, void *va)
+{
+	struct Env *e;
+	int r;
+
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	env_page_remove(e, va);
+	return 0;
+}
+
+// Run up to 'max' of the system calls queued on the current
+// environment's batch ring at UBATCH, in order, posting each result
+// on the completion queue.  Stops early when the submission queue runs
+// dry or the completion queue fills up.  A batch can't contain
+// SYS_batch_enter; that entry's result is -E_INVAL.
+//
+// The ring is read and written with copyin() and copyout(), like any
+// other user memory: it's an ordinary page of the environment's, and
+// might be copy-on-write or not there at all.
+//
+// Returns the number of calls run, or -E_FAULT if the ring can't be
+// read or written, or -E_INVAL if its indices make no sense.
+static int
+sys_batch_enter(uint32_t max)
+{
+	struct BatchRing *ring = (struct BatchRing *) UBATCH;
+	uint32_t idx[4];	// br_sq_head, br_sq_tail, br_cq_head, br_cq_tail
+	struct BatchSqe sqe;
+	struct BatchCqe cqe;
+	uint32_t *a;
+	int r, n;
+
+	if ((r = copyin(idx, ring, sizeof(idx))) < 0)
+		return r;
+	if (idx[1] - idx[0] > BATCH_NENTRY || idx[3] - idx[2] > BATCH_NENTRY)
+		return -E_INVAL;
+
+	for (n = 0; n < max && idx[0] != idx[1]
+		     && idx[3] - idx[2] < BATCH_NENTRY; n++) {
+		r = copyin(&sqe, &ring->br_sq[idx[0] % BATCH_NENTRY],
+			   sizeof(sqe));
+		if (r < 0)
+			break;
+		idx[0]++;
+		a = sqe.bs_args;
+		cqe.bc_tag = sqe.bs_tag;
+		if (sqe.bs_num == SYS_batch_enter)
+			cqe.bc_result = -E_INVAL;
+		else
+			cqe.bc_result = syscall(sqe.bs_num, a[0], a[1], a[2],
+						a[3], a[4]);
+		r = copyout(&ring->br_cq[idx[3] % BATCH_NENTRY], &cqe,
+			    sizeof(cqe));
+		if (r < 0)
+			break;
+		idx[3]++;
+	}
+
+	if (copyout((void *) &ring->br_sq_head, &idx[0], sizeof(idx[0])) < 0
+	    || copyout((void *) &ring->br_cq_tail, &idx[3], sizeof(idx[3])) < 0
+	    || r < 0)
+		return -E_FAULT;
+	return n;
+}
+
+// Dispatches to the correct kernel function, passing the arguments.
+// Both int $T_SYSCALL and sysenter come here, and so does each call
+// in a batch.
+int32_t
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3,
+	uint32_t a4, uint32_t a5)
+{
+	switch (syscallno) {
+	case SYS_cputs:
+		return sys_cputs((const char *) a1, a2);
+	case SYS_cgetc:
+		return sys_cgetc();
+	case SYS_getenvid:
+		return sys_getenvid();
+	case SYS_env_destroy:
+		return sys_env_destroy(a1);
+	case SYS_page_alloc:
+		return sys_page_alloc(a1, (void *) a2, a3);
+	case SYS_page_map:
+		return sys_page_map(a1, (void *) a2, a3, (void *) a4, a5);
+	case SYS_page_unmap:
+		return sys_page_unmap(a1, (void *) a2);
+	case SYS_batch_enter:
+		return sys_batch_enter(a1);
+	default:
+		return -E_INVAL;
+	}
+}
+
+
+// Set if the CPUs have sysenter, and it leads to sysenter_handler.
+bool sysenter_enabled;
+
+// The stacks sysenter_handler starts out on, one per CPU.  It only
+// pushes a word or two there before it moves to ts_esp0, but a debug
+// trap or an NMI can arrive first, and needs room for its frame.
+#define SYSENTER_STKSIZE	PGSIZE
+static uint32_t sysenter_stacks[NCPU][SYSENTER_STKSIZE / 4]
+	__attribute__((aligned(PGSIZE)));
+
+// Program this CPU's sysenter MSRs.  SYSENTER_ESP points at the top
+// word of this CPU's sysenter stack, which holds the address of its
+// ts_esp0: sysenter_handler moves from there to the stack that
+// int $T_SYSCALL would switch to.
+void
+sysenter_init_percpu(void)
+{
+	extern void sysenter_handler();
+	uint32_t *top = &sysenter_stacks[cpunum()][SYSENTER_STKSIZE / 4 - 1];
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_SEP))
+		return;
+	sysenter_enabled = 1;
+	*top = (uintptr_t) &thiscpu->cpu_ts.ts_esp0;
+	wrmsr(MSR_IA32_SYSENTER_CS, GD_KT);
+	wrmsr(MSR_IA32_SYSENTER_ESP, (uintptr_t) top);
+	wrmsr(MSR_IA32_SYSENTER_EIP, (uintptr_t) sysenter_handler);
+}
+
+
+// The user-mode benchmarks in kern/usyscall.S, and their results
+extern char usyscall_start[], usyscall_end[], ubench_entry[], ubatch_entry[];
+extern char ustep_entry[];
+extern uint64_t ub_int_cycles, ub_sysenter_cycles;
+extern uint64_t ub_single_cycles, ub_batch_cycles;
+extern uint32_t ub_int_ret, ub_sysenter_ret, ub_step_ret, ub_niter;
+extern uint32_t ub_single_err, ub_batch_err, ub_batch_ncqe;
+
+#define UB(kva, sym)	((void *) ((kva) + ((char *) &(sym) - usyscall_start)))
+
+// Run a user-mode benchmark, starting at entry, in a new environment
+// with niter for its iteration count, and return its page, with the
+// results in it.  The caller page_decref()s the page.
+static struct Page *
+syscall_bench_run(char *entry, int niter, envid_t *envid)
+{
+	struct Env *e;
+	struct Page *pp;
+	char *kva;
+	int r;
+
+	assert(usyscall_end - usyscall_start <= PGSIZE);
+	if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+		return NULL;
+	pp->pp_ref++;			// ours, to read the results
+	kva = page2kva(pp);
+	memmove(kva, usyscall_start, usyscall_end - usyscall_start);
+	*(uint32_t *) UB(kva, ub_niter) = niter;
+
+	if ((r = env_alloc(&e, 0)) < 0) {
+		cprintf("syscall_bench: %e\n", r);
+		page_decref(pp);
+		return NULL;
+	}
+	if ((r = env_page_insert(e, pp, (void *) UTEXT, PTE_U | PTE_W)) < 0) {
+		cprintf("syscall_bench: %e\n", r);
+		env_free(e);
+		page_decref(pp);
+		return NULL;
+	}
+	e->env_tf.tf_eip = UTEXT + (entry - usyscall_start);
+	*envid = e->env_id;
+	env_run(e);
+	return pp;
+}
+
+//
+// Check that a user environment gets to the kernel and back both
+// ways, and that the system call sees it as curenv; and that sysenter
+// with TF set doesn't trip up the kernel.
+//
+void
+check_syscall(void)
+{
+	struct Page *pp;
+	envid_t envid;
+	char *kva;
+
+	pp = syscall_bench_run(ubench_entry, 10, &envid);
+	assert(pp);
+	kva = page2kva(pp);
+	assert(*(uint32_t *) UB(kva, ub_int_ret) == envid);
+	if (sysenter_enabled)
+		assert(*(uint32_t *) UB(kva, ub_sysenter_ret) == envid);
+	assert(envs[ENVX(envid)].env_status == ENV_FREE);
+	page_decref(pp);
+
+	if (sysenter_enabled) {
+		pp = syscall_bench_run(ustep_entry, 1, &envid);
+		assert(pp);
+		kva = page2kva(pp);
+		assert(*(uint32_t *) UB(kva, ub_step_ret) == envid);
+		assert(envs[ENVX(envid)].env_status == ENV_FREE);
+		page_decref(pp);
+	}
+	cprintf("check_syscall() succeeded!\n");
+}
+
+//
+// Time a null system call (SYS_getenvid) from user mode and back,
+// through int $T_SYSCALL and a full trapframe, and through sysenter
+// and sysexit.
+//
+void
+syscall_bench(int niter)
+{
+	struct Page *pp;
+	envid_t envid;
+	char *kva;
+
+	if ((pp = syscall_bench_run(ubench_entry, niter, &envid)) == NULL)
+		return;
+	kva = page2kva(pp);
+	cprintf("%-10s %18s\n", "path", "cycles/round trip");
+	cprintf("%-10s %18llu\n", "int",
+		*(uint64_t *) UB(kva, ub_int_cycles) / niter);
+	if (sysenter_enabled)
+		cprintf("%-10s %18llu\n", "sysenter",
+			*(uint64_t *) UB(kva, ub_sysenter_cycles) / niter);
+	else
+		cprintf("%-10s %18s\n", "sysenter", "(no SEP)");
+	page_decref(pp);
+}
+
+//
+// Check the batch ring from user mode: a batch that fills the ring,
+// and a partial one after it.  Every call in them has to succeed, and
+// complete once.
+//
+void
+check_batch(void)
+{
+	struct Page *pp;
+	envid_t envid;
+	char *kva;
+	int niter = BATCH_NENTRY / 2 + 8;
+
+	static_assert(sizeof(struct BatchSqe) == 32);
+	static_assert(offsetof(struct BatchRing, br_sq) == BR_SQ);
+	static_assert(offsetof(struct BatchRing, br_cq) == BR_CQ);
+
+	pp = syscall_bench_run(ubatch_entry, niter, &envid);
+	assert(pp);
+	kva = page2kva(pp);
+	assert(*(uint32_t *) UB(kva, ub_single_err) == 0);
+	assert(*(uint32_t *) UB(kva, ub_batch_err) == 0);
+	assert(*(uint32_t *) UB(kva, ub_batch_ncqe) == 2 * niter);
+	assert(envs[ENVX(envid)].env_status == ENV_FREE);
+	page_decref(pp);
+	cprintf("check_batch() succeeded!\n");
+}
+
+//
+// Time the mapping work of a fork, niter pages of it: a map and an
+// unmap per page, as a system call each and through the batch ring.
+//
+void
+batch_bench(int niter)
+{
+	struct Page *pp;
+	envid_t envid;
+	char *kva;
+
+	if ((pp = syscall_bench_run(ubatch_entry, niter, &envid)) == NULL)
+		return;
+	kva = page2kva(pp);
+	if (*(uint32_t *) UB(kva, ub_single_err)
+	    || *(uint32_t *) UB(kva, ub_batch_err))
+		cprintf("batch_bench: some calls failed\n");
+	cprintf("%-10s %18s\n", "path", "cycles/page");
+	cprintf("%-10s %18llu\n", "single",
+		*(uint64_t *) UB(kva, ub_single_cycles) / niter);
+	cprintf("%-10s %18llu\n", "batched",
+		*(uint64_t *) UB(kva, ub_batch_cycles) / niter);
+	page_decref(pp);
+}
@@ -0,0 +1,20 @@
+#ifndef JOS_KERN_SYSCALL_H
+#define JOS_KERN_SYSCALL_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/syscall.h>
+
+extern bool sysenter_enabled;
+
+int32_t	syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+		uint32_t a4, uint32_t a5);
+void	sysenter_init_percpu(void);
+
+void	check_syscall(void);
+void	syscall_bench(int niter);
+void	check_batch(void);
+void	batch_bench(int niter);
+
+#endif /* !JOS_KERN_SYSCALL_H */
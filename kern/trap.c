@@ -0,0 +1,257 @@
+#include <inc/mmu.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/trap.h>
+#include <kern/console.h>
+#include <kern/monitor.h>
+#include <kern/cpu.h>
+#include <kern/sched.h>
+#include <kern/fpu.h>
+#include <kern/syscall.h>
+
+/* Interrupt descriptor table.  (Must be built at run time because
+ * shifted function addresses can't be represented in relocation records.)
+ */
+struct Gatedesc idt[256] = { { 0 } };
+struct Pseudodesc idt_pd = {
+	sizeof(idt) - 1, (uint32_t) idt
+};
+
+
+static const char *trapname(int trapno)
+{
+	static const char * const excnames[] = {
+		"Divide error",
+		"Debug",
+		"Non-Maskable Interrupt",
+		"Breakpoint",
+		"Overflow",
+		"BOUND Range Exceeded",
+		"Invalid Opcode",
+		"Device Not Available",
+		"Double Fault",
+		"Coprocessor Segment Overrun",
+		"Invalid TSS",
+		"Segment Not Present",
+		"Stack Fault",
+		"General Protection",
+		"Page Fault",
+		"(unknown trap)",
+		"x87 FPU Floating-Point Error",
+		"Alignment Check",
+		"Machine-Check",
+		"SIMD Floating-Point Exception"
+	};
+
+	if (trapno < sizeof(excnames)/sizeof(excnames[0]))
+		return excnames[trapno];
+	return "(unknown trap)";
+}
+
+
+// Build the IDT and load it on the boot CPU.
+void
+idt_init(void)
+{
+	extern void t_divide(), t_debug(), t_nmi(), t_brkpt(), t_oflow(),
+		t_bound(), t_illop(), t_device(), t_dblflt(), t_tss(),
+		t_segnp(), t_stack(), t_gpflt(), t_pgflt(), t_fperr(),
+		t_align(), t_mchk(), t_simderr(), t_syscall(), t_irq_timer(),
+		t_irq_spurious();
+
+	SETGATE(idt[T_DIVIDE], 0, GD_KT, t_divide, 0);
+	SETGATE(idt[T_DEBUG], 0, GD_KT, t_debug, 0);
+	SETGATE(idt[T_NMI], 0, GD_KT, t_nmi, 0);
+	SETGATE(idt[T_BRKPT], 0, GD_KT, t_brkpt, 3);
+	SETGATE(idt[T_OFLOW], 0, GD_KT, t_oflow, 0);
+	SETGATE(idt[T_BOUND], 0, GD_KT, t_bound, 0);
+	SETGATE(idt[T_ILLOP], 0, GD_KT, t_illop, 0);
+	SETGATE(idt[T_DEVICE], 0, GD_KT, t_device, 0);
+	SETGATE(idt[T_DBLFLT], 0, GD_KT, t_dblflt, 0);
+	SETGATE(idt[T_TSS], 0, GD_KT, t_tss, 0);
+	SETGATE(idt[T_SEGNP], 0, GD_KT, t_segnp, 0);
+	SETGATE(idt[T_STACK], 0, GD_KT, t_stack, 0);
+	SETGATE(idt[T_GPFLT], 0, GD_KT, t_gpflt, 0);
+	SETGATE(idt[T_PGFLT], 0, GD_KT, t_pgflt, 0);
+	SETGATE(idt[T_FPERR], 0, GD_KT, t_fperr, 0);
+	SETGATE(idt[T_ALIGN], 0, GD_KT, t_align, 0);
+	SETGATE(idt[T_MCHK], 0, GD_KT, t_mchk, 0);
+	SETGATE(idt[T_SIMDERR], 0, GD_KT, t_simderr, 0);
+	SETGATE(idt[T_SYSCALL], 0, GD_KT, t_syscall, 3);
+
+	SETGATE(idt[IRQ_OFFSET + IRQ_TIMER], 0, GD_KT, t_irq_timer, 0);
+	SETGATE(idt[IRQ_OFFSET + IRQ_SPURIOUS], 0, GD_KT, t_irq_spurious, 0);
+
+	idt_init_percpu();
+}
+
+// Load the IDT, and set up sysenter.  All CPUs share one IDT; the
+// others call this from mp_main().
+void
+idt_init_percpu(void)
+{
+	lidt(&idt_pd);
+	sysenter_init_percpu();
+}
+
+void
+print_trapframe(struct Trapframe *tf)
+{
+	cprintf("TRAP frame at %p from CPU %d\n", tf, cpunum());
+	print_regs(&tf->tf_regs);
+	cprintf("  es   0x----%04x\n", tf->tf_es);
+	cprintf("  ds   0x----%04x\n", tf->tf_ds);
+	cprintf("  trap 0x%08x %s\n", tf->tf_trapno, trapname(tf->tf_trapno));
+	if (tf->tf_trapno == T_PGFLT)
+		cprintf("  cr2  0x%08x\n", rcr2());
+	cprintf("  err  0x%08x\n", tf->tf_err);
+	cprintf("  eip  0x%08x\n", tf->tf_eip);
+	cprintf("  cs   0x----%04x\n", tf->tf_cs);
+	cprintf("  flag 0x%08x\n", tf->tf_eflags);
+	if ((tf->tf_cs & 3) != 0) {
+		cprintf("  esp  0x%08x\n", tf->tf_esp);
+		cprintf("  ss   0x----%04x\n", tf->tf_ss);
+	}
+}
+
+void
+print_regs(struct PushRegs *regs)
+{
+	cprintf("  edi  0x%08x\n", regs->reg_edi);
+	cprintf("  esi  0x%08x\n", regs->reg_esi);
+	cprintf("  ebp  0x%08x\n", regs->reg_ebp);
+	cprintf("  oesp 0x%08x\n", regs->reg_oesp);
+	cprintf("  ebx  0x%08x\n", regs->reg_ebx);
+	cprintf("  edx  0x%08x\n", regs->reg_edx);
+	cprintf("  ecx  0x%08x\n", regs->reg_ecx);
+	cprintf("  eax  0x%08x\n", regs->reg_eax);
+}
+
+static void
+trap_dispatch(struct Trapframe *tf)
+{
+	extern void sysenter_handler();
+
+	switch (tf->tf_trapno) {
+	case T_PGFLT:
+		page_fault_handler(tf);
+		return;
+	case T_BRKPT:
+		monitor(tf);
+		return;
+	case T_DEBUG:
+		// sysenter leaves TF alone, so an environment that was
+		// single-stepping gets here from the instruction that
+		// starts sysenter_handler.  Stop stepping, and go on.
+		if (tf->tf_cs == GD_KT
+		    && tf->tf_eip == (uintptr_t) sysenter_handler) {
+			tf->tf_eflags &= ~FL_TF;
+			return;
+		}
+		break;
+	case T_DEVICE:
+		// Environments get the FPU on first use.  The kernel
+		// itself doesn't use it.
+		if (curenv) {
+			fpu_trap();
+			return;
+		}
+		break;
+	case T_SYSCALL:
+		tf->tf_regs.reg_eax = syscall(tf->tf_regs.reg_eax,
+			tf->tf_regs.reg_edx, tf->tf_regs.reg_ecx,
+			tf->tf_regs.reg_ebx, tf->tf_regs.reg_edi,
+			tf->tf_regs.reg_esi);
+		return;
+	case IRQ_OFFSET + IRQ_TIMER:
+		lapic_eoi();
+		sched_tick();
+		return;
+	case IRQ_OFFSET + IRQ_SPURIOUS:
+		// Handle spurious interrupts
+		// The hardware sometimes raises these because of noise on the
+		// IRQ line or other reasons. We don't care.
+		cprintf("Spurious interrupt on irq 7\n");
+		print_trapframe(tf);
+		return;
+	}
+
+	// Unexpected trap: The user process or the kernel has a bug.
+	print_trapframe(tf);
+	if (tf->tf_cs == GD_KT)
+		panic("unhandled trap in kernel");
+	else
+		env_destroy(curenv);
+}
+
+void
+trap(struct Trapframe *tf)
+{
+	// Some versions of GCC rely on DF being clear
+	asm volatile("cld" ::: "cc");
+
+	trap_dispatch(tf);
+
+	// Whatever trapped has been taken care of; trapentry.S returns
+	// to it, in user mode or not.  The kernel only turns interrupts
+	// on where it holds no locks, so whatever the clock interrupted
+	// can carry on.
+}
+
+
+// If the kernel instruction that trapped has an entry in the fixup
+// table, make tf resume at its fixup and return 1.
+static bool
+trap_fixup(struct Trapframe *tf)
+{
+	extern const struct Fixup __FIXUP_BEGIN__[], __FIXUP_END__[];
+	const struct Fixup *fx;
+
+	if ((tf->tf_cs & 3) != 0)
+		return 0;
+	for (fx = __FIXUP_BEGIN__; fx < __FIXUP_END__; fx++)
+		if (fx->fx_eip == tf->tf_eip) {
+			tf->tf_eip = fx->fx_fixup;
+			return 1;
+		}
+	return 0;
+}
+
+void
+page_fault_handler(struct Trapframe *tf)
+{
+	uint32_t fault_va;
+
+	// Read processor's CR2 register to find the faulting address
+	fault_va = rcr2();
+
+	// A write to a present, copy-on-write page: give this address
+	// space its own copy, and retry the write.
+	if ((tf->tf_err & (FEC_PR | FEC_WR)) == (FEC_PR | FEC_WR)
+	    && pgdir_cow_fault(KADDR(rcr3()), fault_va) == 0)
+		return;
+
+	// A first touch of a page in one of the current environment's
+	// demand-zero regions: map it.
+	if (!(tf->tf_err & FEC_PR) && curenv
+	    && env_zero_fault(curenv, fault_va) == 0)
+		return;
+
+	// A bad user pointer in copyin() or copyout(): fail the copy.
+	if (trap_fixup(tf))
+		return;
+
+	if ((tf->tf_cs & 3) == 0) {
+		print_trapframe(tf);
+		panic("page fault at va %08x, ip %08x", fault_va, tf->tf_eip);
+	}
+
+	// Destroy the environment that caused the fault.
+	cprintf("[%08x] user fault va %08x ip %08x\n",
+		curenv->env_id, fault_va, tf->tf_eip);
+	print_trapframe(tf);
+	env_destroy(curenv);
+}
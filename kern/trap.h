@@ -0,0 +1,29 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TRAP_H
+#define JOS_KERN_TRAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+#include <inc/mmu.h>
+
+// An entry in the fixup table, the .fixup section: if the kernel
+// instruction at fx_eip faults, the trap handler resumes at fx_fixup
+// instead of panicking.
+struct Fixup {
+	uintptr_t fx_eip;
+	uintptr_t fx_fixup;
+};
+
+/* The kernel's interrupt descriptor table */
+extern struct Gatedesc idt[];
+
+void idt_init(void);
+void idt_init_percpu(void);
+void print_regs(struct PushRegs *regs);
+void print_trapframe(struct Trapframe *tf);
+void page_fault_handler(struct Trapframe *);
+
+#endif /* JOS_KERN_TRAP_H */